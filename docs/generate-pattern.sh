@@ -4,25 +4,63 @@ set -e
 
 d0="$(cd "$(dirname "$0")" && pwd)"
 outdir=.
+n_jobs="$(nproc 2>/dev/null || echo 1)"
 
 while (($# > 0)); do
 	case "$1" in
 		-outdir)
 			outdir="$2"
 			shift 2;;
+		-j)
+			n_jobs="$2"
+			shift 2;;
 		*)
 			echo "Error: unknown argument: $1" >&2
 			exit 1;;
 	esac
 done
 
-videogen="$d0/../tool/videogen.py"
+if ! [[ "$n_jobs" =~ ^[0-9]+$ ]] || ((10#$n_jobs < 1)); then
+	echo "Error: -j requires a positive number: $n_jobs" >&2
+	exit 1
+fi
+n_jobs=$((10#$n_jobs))
+
+# The native version of tool/videogen.py streams the frames to ffmpeg.
+src="$d0/../src"
+workdir="$(mktemp -d)"
+trap 'rm -rf "$workdir"' EXIT
+"${CXX:-c++}" -O2 -std=c++17 -I"$src" \
+	"$d0/../tool/videogen.cpp" "$src/sync-test-pattern.cpp" "$src/sync-test-qrencode.cpp" \
+	-o "$workdir/videogen"
+videogen="$workdir/videogen"
 
 mkdir -p "$outdir"
 
-"$videogen" --vr 60         --ar 48000 'q=4,f=884,c=2' -o "$outdir/sync-pattern-6000.mp4"
-"$videogen" --vr 60000/1001 --ar 48000 'q=4,f=884,c=2' -o "$outdir/sync-pattern-5994.mp4"
-"$videogen" --vr 50         --ar 48000 'q=4,f=884,c=2' -o "$outdir/sync-pattern-5000.mp4"
-"$videogen" --vr 24         --ar 48000 'q=2,f=884,c=2' -o "$outdir/sync-pattern-2400.mp4"
-"$videogen" --vr 24000/1001 --ar 48000 'q=2,f=884,c=2' -o "$outdir/sync-pattern-2398.mp4"
-"$videogen" --vr 30         --ar 44100 'q=4,f=884,c=2' -o "$outdir/sync-pattern-3000-small.mp4" --size 320x180
+pids=()
+run() {
+	while (($(jobs -rp | wc -l) >= n_jobs)); do
+		wait -n || true
+	done
+	"$videogen" -w "$workdir" "$@" &
+	pids+=($!)
+}
+
+run --vr 60         --ar 48000 'q=4,f=884,c=2' -o "$outdir/sync-pattern-6000.mp4"
+run --vr 60000/1001 --ar 48000 'q=4,f=884,c=2' -o "$outdir/sync-pattern-5994.mp4"
+run --vr 50         --ar 48000 'q=4,f=884,c=2' -o "$outdir/sync-pattern-5000.mp4"
+run --vr 24         --ar 48000 'q=2,f=884,c=2' -o "$outdir/sync-pattern-2400.mp4"
+run --vr 24000/1001 --ar 48000 'q=2,f=884,c=2' -o "$outdir/sync-pattern-2398.mp4"
+run --vr 30         --ar 44100 'q=4,f=884,c=2' -o "$outdir/sync-pattern-3000-small.mp4" --size 320x180
+
+# High-rate patterns with 16-bit index
+run --vr 60         --ar 48000 --protocol 2 --binary-qr 'q=2,f=1768,c=2' -o "$outdir/sync-pattern-6000-v2.mp4"
+run --vr 60000/1001 --ar 48000 --protocol 2 --binary-qr 'q=2,f=1768,c=2' -o "$outdir/sync-pattern-5994-v2.mp4"
+run --vr 50         --ar 48000 --protocol 2 --binary-qr 'q=2,f=1768,c=2' -o "$outdir/sync-pattern-5000-v2.mp4"
+
+# The status of a job is kept even if it was already reaped by `wait -n`.
+rc=0
+for pid in "${pids[@]}"; do
+	wait "$pid" || rc=1
+done
+exit $rc
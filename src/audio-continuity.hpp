@@ -0,0 +1,114 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <util/util_uint64.h>
+
+/* Continuity of the audio.
+ * `samples` of the discontinuity is positive if the following audio is delayed,
+ * that is, the timestamps skipped forward or samples were inserted,
+ * and negative if the following audio is advanced by overlapping timestamps or dropped samples. */
+
+/* Threshold of a slip in samples. The marker positions of `tool/videogen.py` are rounded to
+ * a sample if the frame rate does not divide the sample rate. */
+#define ST_SLIP_THRESHOLD 1.5
+#define ST_SLIP_LEARN_INTERVALS 4
+#define ST_SLIP_MAX_OUTLIERS 3
+#define ST_SLIP_MAX_MARKERS 8
+
+/* Expects the timestamp of the next packet from the previous packet. */
+struct st_audio_timestamp_check
+{
+	uint64_t next_ts = 0;
+
+	void reset() { next_ts = 0; }
+
+	/* Returns the jump of the timestamp in samples. */
+	int64_t packet(uint64_t ts, uint32_t frames, uint32_t sample_rate)
+	{
+		const uint64_t expected = next_ts;
+		next_ts = ts + util_mul_div64(frames, 1000000000ULL, sample_rate);
+		if (!expected)
+			return 0;
+
+		/* Rounding of the timestamps is far less than a half sample. */
+		const double d = ((double)ts - (double)expected) * sample_rate * 1e-9;
+		return llround(d);
+	}
+};
+
+/* Tracks the position of the markers of one carrier.
+ * The peak of the detector tells the position of the marker only in a few samples
+ * but the baseband phase of the preamble tells the position in a fraction of the carrier cycle.
+ * The markers are expected at a constant interval so that a step of the position tells samples
+ * dropped or inserted while the timestamps are continuous.
+ * The expected position is smoothed to reject the noise of each measurement. */
+struct st_carrier_slip
+{
+	uint64_t last_ts = 0;
+	float last_phase = 0.0f;
+	int last_index = -1;
+	double period = 0.0; // interval of the markers in samples
+	double offset = 0.0; // expected position relative to the last marker in samples
+	int n_periods = 0;
+	int n_outliers = 0;
+
+	void reset() { *this = st_carrier_slip(); }
+
+	/* Forgets the last marker but keeps the learned interval. */
+	void restart() { last_index = -1; }
+
+	/* Returns the slip in samples since the last marker.
+	 * `phase` is the argument of the baseband of the preamble in radian. */
+	int64_t marker(uint64_t ts, float phase, int index, uint32_t index_max, uint32_t f, uint32_t sample_rate)
+	{
+		const uint64_t prev_ts = last_ts;
+		const float prev_phase = last_phase;
+		const int prev_index = last_index;
+		last_ts = ts;
+		last_phase = phase;
+		last_index = index;
+
+		if (prev_index < 0 || ts <= prev_ts || !index_max || !f)
+			return 0;
+		const int n = (int)((index_max + index - prev_index) % index_max);
+		if (n <= 0 || n > ST_SLIP_MAX_MARKERS)
+			return 0;
+
+		/* The baseband phase goes backward by one cycle for each carrier cycle of the delay.
+		 * Take the interval closest to the peaks of the detector. */
+		const double cycle = (double)sample_rate / f;
+		const double coarse = (double)(ts - prev_ts) * sample_rate * 1e-9;
+		double fine = -(double)(phase - prev_phase) / (2.0 * M_PI) * cycle;
+		fine += cycle * round((coarse - fine) / cycle);
+
+		const double e = fine - (period * n + offset);
+		if (n_periods < ST_SLIP_LEARN_INTERVALS) {
+			if (n_periods > 0 && fabs(fine - period * n) > ST_SLIP_THRESHOLD)
+				n_periods = 0;
+			n_periods++;
+			period = n_periods == 1 ? fine / n : period + (fine / n - period) / n_periods;
+			offset = 0.0;
+			return 0;
+		}
+
+		if (fabs(e) <= ST_SLIP_THRESHOLD) {
+			/* Follow the drift of the clock of the source. */
+			n_outliers = 0;
+			period += e / n * 0.05;
+			offset = -e * 0.75;
+			return 0;
+		}
+
+		/* The learned interval is wrong if the slips continue. */
+		if (++n_outliers >= ST_SLIP_MAX_OUTLIERS) {
+			n_outliers = 0;
+			n_periods = 1;
+			period = fine / n;
+			offset = 0.0;
+			return 0;
+		}
+		offset = 0.0;
+		return llround(e);
+	}
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include "sync-test-output.hpp"
+
+/* Measures the delivered frame cadence from the pattern.
+ * The pattern shows the QR code, the sync pattern 0, and the sync pattern 1
+ * for `q` frames each, so the length of a run of the same state tells how
+ * many frames were duplicated or dropped on the way to OBS Studio.
+ * The intervals of the timestamps are measured separately.
+ * Everything is kept in a constant memory. */
+
+enum st_cadence_state {
+	ST_CADENCE_NONE = -1,
+	ST_CADENCE_QR = 0,
+	ST_CADENCE_SYNC0 = 1,
+	ST_CADENCE_SYNC1 = 2,
+	ST_CADENCE_N_STATES = 3,
+};
+
+struct st_cadence_analyzer
+{
+	struct st_cadence_stats stats = {};
+
+	int state = ST_CADENCE_NONE;
+	uint32_t run = 0;
+	bool run_valid = false; // the run started at a transition
+	float level_peak = 0.0f;
+
+	uint64_t last_ts = 0;
+	double interval_m2 = 0.0;
+
+	void reset()
+	{
+		stats = {};
+		state = ST_CADENCE_NONE;
+		run = 0;
+		run_valid = false;
+		level_peak = 0.0f;
+		last_ts = 0;
+		interval_m2 = 0.0;
+	}
+
+	/* The level is `st_overlay_data::level` of the marker.
+	 * The threshold follows the contrast of the pattern as seen by the camera. */
+	int classify(float level)
+	{
+		const float a = fabsf(level);
+		level_peak = std::max(a, level_peak * 0.95f);
+		const float th = level_peak * 0.4f;
+		if (level < -th)
+			return ST_CADENCE_SYNC0;
+		if (level > th)
+			return ST_CADENCE_SYNC1;
+		return ST_CADENCE_QR;
+	}
+
+	/* Counts a delivered frame of the state. `expected` is the number of the frames of each state.
+	 * Returns true when a cycle of the pattern is completed. */
+	bool frame(int new_state, uint32_t expected)
+	{
+		if (new_state == state && new_state != ST_CADENCE_NONE) {
+			run++;
+			return false;
+		}
+
+		bool cycle = false;
+		if (run_valid && new_state != ST_CADENCE_NONE && expected > 0) {
+			stats.expected = expected;
+			stats.states++;
+			stats.frames += run;
+			if (run > expected)
+				stats.duplicated += run - expected;
+			else
+				stats.dropped += expected - run;
+
+			/* States missing between the two runs are dropped entirely. */
+			int skipped = (new_state - state - 1 + ST_CADENCE_N_STATES) % ST_CADENCE_N_STATES;
+			stats.states += (uint64_t)skipped;
+			stats.dropped += (uint64_t)skipped * expected;
+
+			cycle = state == ST_CADENCE_SYNC1 || new_state <= state;
+		}
+
+		run_valid = state != ST_CADENCE_NONE && new_state != ST_CADENCE_NONE;
+		state = new_state;
+		run = 1;
+		return cycle;
+	}
+
+	/* Welford's method on the intervals shorter than 1.5 times the nominal interval.
+	 * A longer interval is a gap of the frames. */
+	void timestamp(uint64_t ts, double nominal_ns)
+	{
+		const uint64_t prev = last_ts;
+		last_ts = ts;
+		if (!prev || ts <= prev || nominal_ns <= 0.0)
+			return;
+
+		const double dt = (double)(ts - prev);
+		if (dt > nominal_ns * 1.5) {
+			stats.gaps += (uint64_t)llround(dt / nominal_ns) - 1;
+			return;
+		}
+
+		stats.intervals++;
+		const double d = dt - stats.interval_mean_ns;
+		stats.interval_mean_ns += d / (double)stats.intervals;
+		interval_m2 += d * (dt - stats.interval_mean_ns);
+		stats.interval_stddev_ns = sqrt(interval_m2 / (double)stats.intervals);
+		stats.jitter_max_ns = std::max(stats.jitter_max_ns, fabs(dt - nominal_ns));
+	}
+};
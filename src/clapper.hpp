@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+#include <math.h>
+#include <stdint.h>
+#include "fft.hpp"
+
+/* Detectors for the clapperboard mode, which measures the latency from a
+ * generic event such as a flash, a slate, or a hand clap instead of the sync
+ * pattern. Both are fed incrementally and keep only a short history. */
+
+/* Returns how much `x` exceeds the running mean by more than `k` times the
+ * running deviation, or 0. The statistics follow the background slowly so
+ * that a steady noise or a gradual change does not make an onset.
+ * No onset is reported until `warmup` values are seen. */
+struct st_onset_threshold
+{
+	float alpha = 0.02f;
+	float k = 4.0f;
+	float min_level = 0.0f;
+	uint32_t warmup = 16;
+
+	float mean = 0.0f;
+	float var = 0.0f;
+	uint32_t n = 0;
+
+	float apply(float x)
+	{
+		if (n < warmup) {
+			/* Plain average to settle the statistics quickly */
+			n++;
+			float d = x - mean;
+			mean += d / (float)n;
+			var += (d * (x - mean) - var) / (float)n;
+			return 0.0f;
+		}
+
+		float th = std::max(min_level, mean + k * sqrtf(var));
+		float score = x > th ? x - th : 0.0f;
+
+		float d = x - mean;
+		mean += alpha * d;
+		var = (1.0f - alpha) * (var + alpha * d * d);
+		return score;
+	}
+
+	void reset()
+	{
+		mean = var = 0.0f;
+		n = 0;
+	}
+};
+
+/* Spectral flux over Hann-windowed blocks of `n` samples with a hop of `n / 2` samples.
+ * The flux is the sum of the increase of the log-compressed magnitude in each bin. */
+struct st_spectral_flux
+{
+	size_t n = 0;
+	size_t hop = 0;
+
+	st_fft fft;
+	std::vector<float> window;
+	std::vector<float> buf; // last `n` samples
+	size_t filled = 0;
+	std::vector<std::complex<float>> work;
+	std::vector<float> mag_prev;
+	bool mag_valid = false;
+
+	float flux = 0.0f;
+
+	void init(size_t n_)
+	{
+		n = n_;
+		hop = n / 2;
+		fft.init(n);
+
+		window.resize(n);
+		for (size_t i = 0; i < n; i++)
+			window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * (double)i / (double)n));
+
+		buf.assign(n, 0.0f);
+		filled = 0;
+		work.resize(n);
+		mag_prev.assign(n / 2, 0.0f);
+		mag_valid = false;
+	}
+
+	/* Returns true when `flux` has been updated for the last `hop` samples. */
+	bool push(float x)
+	{
+		buf[filled++] = x;
+		if (filled < n)
+			return false;
+
+		for (size_t i = 0; i < n; i++)
+			work[i] = buf[i] * window[i];
+		fft.forward(work.data());
+
+		float sum = 0.0f;
+		for (size_t i = 1; i < n / 2; i++) {
+			float mag = log1pf(std::abs(work[i]) * 10.0f);
+			if (mag_valid && mag > mag_prev[i])
+				sum += mag - mag_prev[i];
+			mag_prev[i] = mag;
+		}
+		flux = mag_valid ? sum / (float)(n / 2) : 0.0f;
+		mag_valid = true;
+
+		std::copy(buf.begin() + hop, buf.end(), buf.begin());
+		filled = n - hop;
+		return true;
+	}
+
+	void reset()
+	{
+		filled = 0;
+		mag_valid = false;
+	}
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include "sync-test-output.hpp"
+
+/* Running estimate of the latency `audio_ts - video_ts` of one audio carrier.
+ * The estimate has converged when the 95% confidence interval of the mean is
+ * not wider than the requested width. A few pairs are required first so that
+ * the standard deviation is not underestimated.
+ * A carrier paired less than 1 / ST_CONVERGENCE_MINOR_RATIO times as often as
+ * the most frequent carrier, such as a spurious decode, does not hold the stop. */
+
+#define ST_CONVERGENCE_MIN_SYNCS 10
+#define ST_CONVERGENCE_Z95 1.96
+#define ST_CONVERGENCE_MINOR_RATIO 4
+
+struct st_latency_estimator
+{
+	uint32_t f = 0;
+	uint64_t count = 0;
+	double mean_ns = 0.0;
+	double m2 = 0.0;
+
+	void reset() { *this = st_latency_estimator(); }
+
+	/* Welford's method */
+	void add(int64_t latency_ns)
+	{
+		count++;
+		const double d = (double)latency_ns - mean_ns;
+		mean_ns += d / (double)count;
+		m2 += d * ((double)latency_ns - mean_ns);
+	}
+
+	double stddev_ns() const { return count > 1 ? sqrt(m2 / (double)(count - 1)) : 0.0; }
+
+	double ci_ns() const
+	{
+		return count > 1 ? 2.0 * ST_CONVERGENCE_Z95 * stddev_ns() / sqrt((double)count) : INFINITY;
+	}
+
+	bool converged(double width_ns) const { return count >= ST_CONVERGENCE_MIN_SYNCS && ci_ns() <= width_ns; }
+
+	bool minor(uint64_t max_count) const { return count * ST_CONVERGENCE_MINOR_RATIO < max_count; }
+
+	struct st_convergence_s summary() const
+	{
+		struct st_convergence_s s;
+		s.f = f;
+		s.count = count;
+		s.mean_ns = mean_ns;
+		s.stddev_ns = stddev_ns();
+		s.ci_ns = ci_ns();
+		return s;
+	}
+};
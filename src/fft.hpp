@@ -0,0 +1,69 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+#include <math.h>
+
+/* Radix-2 complex FFT with precomputed twiddle factors and bit-reversal table. */
+struct st_fft
+{
+	size_t n = 0;
+	std::vector<std::complex<float>> twiddle;
+	std::vector<uint32_t> rev;
+
+	void init(size_t n_)
+	{
+		n = n_;
+		twiddle.resize(n / 2);
+		for (size_t i = 0; i < n / 2; i++) {
+			double a = -2.0 * M_PI * (double)i / (double)n;
+			twiddle[i] = std::complex<float>((float)cos(a), (float)sin(a));
+		}
+
+		int bits = 0;
+		while (((size_t)1 << bits) < n)
+			bits++;
+		rev.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			uint32_t r = 0;
+			for (int b = 0; b < bits; b++) {
+				if (i & ((size_t)1 << b))
+					r |= 1u << (bits - 1 - b);
+			}
+			rev[i] = r;
+		}
+	}
+
+	void transform(std::complex<float> *x, bool inverse) const
+	{
+		for (size_t i = 0; i < n; i++) {
+			if (i < rev[i])
+				std::swap(x[i], x[rev[i]]);
+		}
+
+		for (size_t len = 2; len <= n; len <<= 1) {
+			const size_t half = len / 2;
+			const size_t step = n / len;
+			for (size_t i = 0; i < n; i += len) {
+				for (size_t j = 0; j < half; j++) {
+					std::complex<float> w = twiddle[j * step];
+					if (inverse)
+						w = std::conj(w);
+					std::complex<float> u = x[i + j];
+					std::complex<float> v = x[i + j + half] * w;
+					x[i + j] = u + v;
+					x[i + j + half] = u - v;
+				}
+			}
+		}
+
+		if (inverse) {
+			const float scale = 1.0f / (float)n;
+			for (size_t i = 0; i < n; i++)
+				x[i] *= scale;
+		}
+	}
+
+	void forward(std::complex<float> *x) const { transform(x, false); }
+	void inverse(std::complex<float> *x) const { transform(x, true); }
+};
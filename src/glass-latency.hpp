@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include "sync-test-output.hpp"
+
+/* Distribution of the glass-to-glass latency measured from the timecode embedded in the pattern.
+ * The histogram has buckets of 1 ms so that the percentiles are kept in a constant memory.
+ * A latency longer than the histogram is counted in the last bucket. */
+
+#define ST_GLASS_HIST_BUCKETS 1000
+#define ST_GLASS_HIST_NS 1000000
+
+struct st_glass_analyzer
+{
+	struct st_glass_stats stats = {};
+	double m2 = 0.0;
+	uint32_t hist[ST_GLASS_HIST_BUCKETS] = {};
+
+	void reset()
+	{
+		stats = {};
+		m2 = 0.0;
+		std::fill(hist, hist + ST_GLASS_HIST_BUCKETS, 0);
+	}
+
+	int64_t percentile(double p) const
+	{
+		uint64_t target = (uint64_t)((double)stats.count * p);
+		for (int i = 0; i < ST_GLASS_HIST_BUCKETS; i++) {
+			if (hist[i] > target)
+				return (int64_t)i * ST_GLASS_HIST_NS + ST_GLASS_HIST_NS / 2;
+			target -= hist[i];
+		}
+		return stats.max_ns;
+	}
+
+	void add(int64_t latency_ns)
+	{
+		stats.last_ns = latency_ns;
+		stats.min_ns = stats.count ? std::min(stats.min_ns, latency_ns) : latency_ns;
+		stats.max_ns = stats.count ? std::max(stats.max_ns, latency_ns) : latency_ns;
+		stats.count++;
+
+		const double d = (double)latency_ns - stats.mean_ns;
+		stats.mean_ns += d / (double)stats.count;
+		m2 += d * ((double)latency_ns - stats.mean_ns);
+		stats.stddev_ns = sqrt(m2 / (double)stats.count);
+
+		int64_t b = std::clamp<int64_t>(latency_ns / ST_GLASS_HIST_NS, 0, ST_GLASS_HIST_BUCKETS - 1);
+		hist[b]++;
+
+		stats.p50_ns = percentile(0.50);
+		stats.p95_ns = percentile(0.95);
+		stats.p99_ns = percentile(0.99);
+	}
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/* Luma pyramid shared by the video stages of one frame.
+ * Level `l` is downscaled by 2^l from the frame. The finest level needed for
+ * the frame is filled from the frame in one pass and the coarser levels are
+ * reduced from it, so that the frame is read only once whichever levels the
+ * stages consume. The buffers are allocated when the levels are set up, not
+ * for each frame. */
+
+#define ST_LUMA_MAX_LEVELS 8
+
+/* 8-bit luma samples, `pixelsize` bytes apart in a line */
+struct st_luma_plane
+{
+	const uint8_t *data = nullptr;
+	size_t linesize = 0;
+	uint32_t pixelsize = 1;
+	uint32_t width = 0;
+	uint32_t height = 0;
+};
+
+struct st_luma_pyramid
+{
+	std::vector<uint8_t> levels[ST_LUMA_MAX_LEVELS];
+	uint32_t width[ST_LUMA_MAX_LEVELS] = {0};
+	uint32_t height[ST_LUMA_MAX_LEVELS] = {0};
+
+	/* Levels `base` to `top` hold the current frame, none if `top` is less than `base`. */
+	int base = 0;
+	int top = -1;
+
+	/* Levels finer than `l_min` are never filled and have no buffer. */
+	void init(uint32_t w, uint32_t h, int l_min)
+	{
+		for (int l = 0; l < ST_LUMA_MAX_LEVELS; l++) {
+			width[l] = w >> l;
+			height[l] = h >> l;
+			if (l < l_min)
+				std::vector<uint8_t>().swap(levels[l]);
+			else
+				levels[l].resize((size_t)width[l] * height[l]);
+		}
+		invalidate();
+	}
+
+	void invalidate()
+	{
+		base = 0;
+		top = -1;
+	}
+
+	bool has(int l) const { return base <= l && l <= top; }
+
+	uint8_t *row(int l, uint32_t y) { return levels[l].data() + (size_t)width[l] * y; }
+
+	struct st_luma_plane plane(int l) const
+	{
+		struct st_luma_plane p;
+		p.data = levels[l].data();
+		p.linesize = width[l];
+		p.width = width[l];
+		p.height = height[l];
+		return p;
+	}
+
+	/* Fill the lines [y_begin, y_end) of level `l` by averaging 2x2 pixels of level `l - 1`. */
+	void reduce_rows(int l, uint32_t y_begin, uint32_t y_end)
+	{
+		const uint32_t w = width[l];
+		for (uint32_t y = y_begin; y < y_end; y++) {
+			const uint8_t *s0 = row(l - 1, 2 * y);
+			const uint8_t *s1 = s0 + width[l - 1];
+			uint8_t *d = row(l, y);
+			for (uint32_t x = 0; x < w; x++)
+				d[x] = (uint8_t)((s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2);
+		}
+	}
+};
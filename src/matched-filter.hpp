@@ -0,0 +1,87 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+#include "fft.hpp"
+
+/* Streaming correlation of a complex signal against a real template using
+ * overlap-save FFT convolution.
+ * For each input sample, the normalized correlation of the last `m` samples
+ * and the template is calculated, which is in the range [0, 1]. */
+struct matched_filter
+{
+	size_t m = 0; // template length
+	size_t n = 0; // FFT length
+	size_t l = 0; // number of new samples for each block
+
+	st_fft fft;
+	std::vector<std::complex<float>> h; // conjugate of FFT of the template
+	float template_energy = 0.0f;
+
+	std::vector<std::complex<float>> buf; // last `m - 1` samples followed by the new samples
+	size_t filled = 0;
+	std::vector<std::complex<float>> work;
+	std::vector<double> energy;
+	std::vector<float> scores;
+
+	void init(const std::vector<float> &tmpl)
+	{
+		m = tmpl.size();
+		n = 1;
+		while (n < m * 2)
+			n <<= 1;
+		l = n - m + 1;
+
+		fft.init(n);
+
+		h.assign(n, std::complex<float>(0.0f, 0.0f));
+		template_energy = 0.0f;
+		for (size_t i = 0; i < m; i++) {
+			h[i] = tmpl[i];
+			template_energy += tmpl[i] * tmpl[i];
+		}
+		fft.forward(h.data());
+		for (auto &x : h)
+			x = std::conj(x);
+
+		buf.assign(n, std::complex<float>(0.0f, 0.0f));
+		filled = m - 1;
+		work.resize(n);
+		energy.resize(n + 1);
+		scores.resize(l);
+	}
+
+	/* Returns true when `scores` has been updated for the last `l` samples. */
+	bool push(std::complex<float> x)
+	{
+		buf[filled++] = x;
+		if (filled < n)
+			return false;
+
+		energy[0] = 0.0;
+		for (size_t i = 0; i < n; i++)
+			energy[i + 1] = energy[i] + std::norm(buf[i]);
+
+		work = buf;
+		fft.forward(work.data());
+		for (size_t i = 0; i < n; i++)
+			work[i] *= h[i];
+		fft.inverse(work.data());
+
+		/* `work[j]` is the correlation of the window starting at `buf[j]`. */
+		for (size_t j = 0; j < l; j++) {
+			double e = (energy[j + m] - energy[j]) * template_energy;
+			scores[j] = e > 1e-12 ? (float)(std::norm(work[j]) / e) : 0.0f;
+		}
+
+		std::copy(buf.end() - (m - 1), buf.end(), buf.begin());
+		filled = m - 1;
+		return true;
+	}
+
+	void reset()
+	{
+		std::fill(buf.begin(), buf.end(), std::complex<float>(0.0f, 0.0f));
+		filled = m - 1;
+	}
+};
@@ -32,6 +32,7 @@ OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
 void *create_sync_test_dock();
 void register_sync_test_output();
 void register_sync_test_monitor(bool list);
+void register_sync_test_generator();
 
 #if LIBOBS_API_VER <= MAKE_SEMANTIC_VERSION(29, 1, 3)
 bool obs_frontend_add_dock_by_id_compat(const char *id, const char *title, void *widget);
@@ -54,6 +55,7 @@ bool obs_module_load(void)
 
 	register_sync_test_output();
 	register_sync_test_monitor(list_source);
+	register_sync_test_generator();
 	blog(LOG_INFO, "plugin loaded (version %s)", PLUGIN_VERSION);
 	blog(LOG_INFO, "quirc (version %s)", quirc_version());
 	return true;
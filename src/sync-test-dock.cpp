@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <QTimer>
 #include <QMainWindow>
 #include <obs-frontend-api.h>
+#include <util/platform.h>
+#include <string>
 #include "plugin-macros.generated.h"
 #include "sync-test-dock.hpp"
 
@@ -57,6 +59,22 @@ SyncTestDock::SyncTestDock(QWidget *parent) : QFrame(parent)
 	latencyPolarity->setObjectName("latencyPolarity");
 	topLayout->addWidget(latencyPolarity, y++, 1);
 
+	label = new QLabel(obs_module_text("Label.Cadence"), this);
+	label->setToolTip(obs_module_text("Label.Cadence.Tooltip"));
+	topLayout->addWidget(label, y, 0);
+
+	cadenceDisplay = new QLabel("-", this);
+	cadenceDisplay->setObjectName("cadenceDisplay");
+	topLayout->addWidget(cadenceDisplay, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.Glass"), this);
+	label->setToolTip(obs_module_text("Label.Glass.Tooltip"));
+	topLayout->addWidget(label, y, 0);
+
+	glassDisplay = new QLabel("-", this);
+	glassDisplay->setObjectName("glassDisplay");
+	topLayout->addWidget(glassDisplay, y++, 1);
+
 	label = new QLabel(obs_module_text("Label.Index"), this);
 	topLayout->addWidget(label, y, 0);
 
@@ -85,16 +103,213 @@ SyncTestDock::SyncTestDock(QWidget *parent) : QFrame(parent)
 	audioIndexDisplay->setObjectName("audioIndexDisplay");
 	topLayout->addWidget(audioIndexDisplay, y++, 1);
 
+	label = new QLabel(obs_module_text("Label.AudioDetector"), this);
+	topLayout->addWidget(label, y, 0);
+
+	audioDetectorCombo = new QComboBox(this);
+	audioDetectorCombo->addItem(obs_module_text("AudioDetector.Energy"), ST_AUDIO_DETECTOR_ENERGY);
+	audioDetectorCombo->addItem(obs_module_text("AudioDetector.Matched"), ST_AUDIO_DETECTOR_MATCHED);
+	topLayout->addWidget(audioDetectorCombo, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.Preset"), this);
+	label->setToolTip(obs_module_text("Label.Preset.Tooltip"));
+	topLayout->addWidget(label, y, 0);
+
+	presetCombo = new QComboBox(this);
+	presetCombo->addItem(obs_module_text("Preset.LowCpu"), "low_cpu");
+	presetCombo->addItem(obs_module_text("Preset.Balanced"), "balanced");
+	presetCombo->addItem(obs_module_text("Preset.HighPrecision"), "high_precision");
+	presetCombo->setCurrentIndex(1);
+	topLayout->addWidget(presetCombo, y++, 1);
+	connect(presetCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this,
+		&SyncTestDock::on_preset_changed);
+
+	watchdogCheck = new QCheckBox(obs_module_text("Label.Watchdog"), this);
+	topLayout->addWidget(watchdogCheck, y, 0);
+
+	watchdogDisplay = new QLabel("-", this);
+	watchdogDisplay->setObjectName("watchdogDisplay");
+	topLayout->addWidget(watchdogDisplay, y++, 1);
+
+	QHBoxLayout *watchdogLayout = new QHBoxLayout();
+
+	watchdogInterval = new QSpinBox(this);
+	watchdogInterval->setRange(1, 3600);
+	watchdogInterval->setValue(10);
+	watchdogInterval->setSuffix(" s");
+	watchdogInterval->setToolTip(obs_module_text("Label.WatchdogInterval"));
+	watchdogLayout->addWidget(watchdogInterval);
+
+	watchdogTolerance = new QSpinBox(this);
+	watchdogTolerance->setRange(1, 1000);
+	watchdogTolerance->setValue(20);
+	watchdogTolerance->setSuffix(" ms");
+	watchdogTolerance->setToolTip(obs_module_text("Label.WatchdogTolerance"));
+	watchdogLayout->addWidget(watchdogTolerance);
+
+	topLayout->addLayout(watchdogLayout, y++, 1);
+
+	autoStopCheck = new QCheckBox(obs_module_text("Label.AutoStop"), this);
+	autoStopCheck->setToolTip(obs_module_text("Label.AutoStop.Tooltip"));
+	topLayout->addWidget(autoStopCheck, y, 0);
+
+	autoStopDisplay = new QLabel("-", this);
+	autoStopDisplay->setObjectName("autoStopDisplay");
+	topLayout->addWidget(autoStopDisplay, y++, 1);
+
+	autoStopWidth = new QDoubleSpinBox(this);
+	autoStopWidth->setRange(0.1, 100.0);
+	autoStopWidth->setDecimals(1);
+	autoStopWidth->setSingleStep(0.5);
+	autoStopWidth->setValue(1.0);
+	autoStopWidth->setSuffix(" ms");
+	autoStopWidth->setToolTip(obs_module_text("Label.AutoStopWidth"));
+	topLayout->addWidget(autoStopWidth, y++, 1);
+
+	clapperCheck = new QCheckBox(obs_module_text("Label.Clapper"), this);
+	clapperCheck->setToolTip(obs_module_text("Label.Clapper.Tooltip"));
+	topLayout->addWidget(clapperCheck, y, 0);
+
+	QHBoxLayout *clapperLayout = new QHBoxLayout();
+	static const char *region_labels[4] = {
+		"Label.Clapper.X",
+		"Label.Clapper.Y",
+		"Label.Clapper.Width",
+		"Label.Clapper.Height",
+	};
+	for (int i = 0; i < 4; i++) {
+		clapperRegion[i] = new QSpinBox(this);
+		clapperRegion[i]->setRange(i < 2 ? 0 : 1, 100);
+		clapperRegion[i]->setValue(i < 2 ? 0 : 100);
+		clapperRegion[i]->setSuffix(" %");
+		clapperRegion[i]->setToolTip(obs_module_text(region_labels[i]));
+		clapperLayout->addWidget(clapperRegion[i]);
+	}
+	topLayout->addLayout(clapperLayout, y++, 1);
+
+	metricsCheck = new QCheckBox(obs_module_text("Label.Metrics"), this);
+	metricsCheck->setToolTip(obs_module_text("Label.Metrics.Tooltip"));
+	topLayout->addWidget(metricsCheck, y++, 0, 1, 2);
+
 	mainLayout->addLayout(topLayout);
+
+	sessionList = new QTreeWidget(this);
+	sessionList->setColumnCount(4);
+	sessionList->setHeaderLabels({obs_module_text("Label.Session"), obs_module_text("Label.Latency"),
+				      obs_module_text("Label.VideoIndex"), obs_module_text("Label.AudioIndex")});
+	sessionList->setRootIsDecorated(false);
+	mainLayout->addWidget(sessionList);
+	connect(sessionList, &QTreeWidget::itemSelectionChanged, this, &SyncTestDock::on_session_selected);
+
+	QHBoxLayout *sessionLayout = new QHBoxLayout();
+
+	sessionName = new QLineEdit(this);
+	sessionName->setPlaceholderText(obs_module_text("Label.SessionName"));
+	sessionLayout->addWidget(sessionName);
+
+	sessionMixer = new QComboBox(this);
+	for (int i = 0; i < MAX_AUDIO_MIXES; i++)
+		sessionMixer->addItem(QStringLiteral("%1 %2").arg(obs_module_text("Label.Track")).arg(i + 1), i);
+	sessionLayout->addWidget(sessionMixer);
+
+	sessionCanvas = new QComboBox(this);
+	sessionCanvas->setEditable(true);
+	update_canvas_list();
+	sessionLayout->addWidget(sessionCanvas);
+
+	addSessionButton = new QPushButton(obs_module_text("Button.AddSession"), this);
+	sessionLayout->addWidget(addSessionButton);
+	connect(addSessionButton, &QPushButton::clicked, this, &SyncTestDock::on_add_session);
+
+	removeSessionButton = new QPushButton(obs_module_text("Button.RemoveSession"), this);
+	sessionLayout->addWidget(removeSessionButton);
+	connect(removeSessionButton, &QPushButton::clicked, this, &SyncTestDock::on_remove_session);
+
+	mainLayout->addLayout(sessionLayout);
+
+	perfToggle = new QToolButton(this);
+	perfToggle->setText(obs_module_text("Label.Performance"));
+	perfToggle->setToolButtonStyle(Qt::ToolButtonTextBesideIcon);
+	perfToggle->setArrowType(Qt::RightArrow);
+	perfToggle->setCheckable(true);
+	perfToggle->setAutoRaise(true);
+	mainLayout->addWidget(perfToggle);
+	connect(perfToggle, &QToolButton::toggled, this, &SyncTestDock::on_perf_toggled);
+
+	perfWidget = new QWidget(this);
+	QGridLayout *perfLayout = new QGridLayout();
+	perfLayout->setContentsMargins(0, 0, 0, 0);
+	y = 0;
+
+	static const char *stage_labels[ST_STAGE_COUNT] = {
+		"Label.Stage.QrFill",    "Label.Stage.Quirc",    "Label.Stage.MarkerSum",
+		"Label.Stage.AudioMix", "Label.Stage.Preamble", "Label.Stage.Matching",
+	};
+	for (int i = 0; i < ST_STAGE_COUNT; i++) {
+		label = new QLabel(obs_module_text(stage_labels[i]), perfWidget);
+		perfLayout->addWidget(label, y, 0);
+
+		perfStageDisplay[i] = new QLabel("-", perfWidget);
+		perfLayout->addWidget(perfStageDisplay[i], y++, 1);
+	}
+
+	label = new QLabel(obs_module_text("Label.VideoFrames"), perfWidget);
+	perfLayout->addWidget(label, y, 0);
+
+	perfVideoFramesDisplay = new QLabel("-", perfWidget);
+	perfLayout->addWidget(perfVideoFramesDisplay, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.RepeatedFrames"), perfWidget);
+	perfLayout->addWidget(label, y, 0);
+
+	perfRepeatedDisplay = new QLabel("-", perfWidget);
+	perfLayout->addWidget(perfRepeatedDisplay, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.AudioPackets"), perfWidget);
+	perfLayout->addWidget(label, y, 0);
+
+	perfAudioPacketsDisplay = new QLabel("-", perfWidget);
+	perfLayout->addWidget(perfAudioPacketsDisplay, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.AudioContinuity"), perfWidget);
+	perfLayout->addWidget(label, y, 0);
+
+	perfAudioContinuityDisplay = new QLabel("-", perfWidget);
+	perfLayout->addWidget(perfAudioContinuityDisplay, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.QrScale"), perfWidget);
+	perfLayout->addWidget(label, y, 0);
+
+	perfQrScaleDisplay = new QLabel("-", perfWidget);
+	perfLayout->addWidget(perfQrScaleDisplay, y++, 1);
+
+	label = new QLabel(obs_module_text("Label.TotalCpu"), perfWidget);
+	perfLayout->addWidget(label, y, 0);
+
+	perfTotalDisplay = new QLabel("-", perfWidget);
+	perfLayout->addWidget(perfTotalDisplay, y++, 1);
+
+	perfWidget->setLayout(perfLayout);
+	perfWidget->setVisible(false);
+	mainLayout->addWidget(perfWidget);
+
+	perfTimer = new QTimer(this);
+	perfTimer->setInterval(1000);
+	connect(perfTimer, &QTimer::timeout, this, &SyncTestDock::update_stats);
+
 	setLayout(mainLayout);
+
+	add_session(obs_module_text("Session.Default"), 0, QString());
+
+	obs_frontend_add_event_callback(cb_frontend_event, this);
 }
 
 SyncTestDock::~SyncTestDock()
 {
-	if (sync_test) {
-		obs_output_stop(sync_test);
-		sync_test = nullptr;
-	}
+	obs_frontend_remove_event_callback(cb_frontend_event, this);
+
+	for (auto &session : sessions)
+		stop_session(session.get());
 }
 
 extern "C" QWidget *create_sync_test_dock()
@@ -108,74 +323,438 @@ extern "C" QWidget *create_sync_test_dock()
 	if (!get_func(cd, #name, &name))  \
 		return;
 
+/* The signals are disconnected before the session is deleted.
+ * The queued calls look up the session again by its ID since the session
+ * might be removed before the call. */
+
 void SyncTestDock::cb_video_marker_found(void *param, calldata_t *cd)
 {
-	auto *dock = (SyncTestDock *)param;
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
 
 	CD_TO_LOCAL(video_marker_found_s *, data, calldata_get_ptr);
 	video_marker_found_s found = *data;
 
-	QMetaObject::invokeMethod(dock, [dock, found]() { dock->on_video_marker_found(found); });
+	QMetaObject::invokeMethod(dock, [dock, id, found]() { dock->on_video_marker_found(id, found); });
 };
 
 void SyncTestDock::cb_audio_marker_found(void *param, calldata_t *cd)
 {
-	auto *dock = (SyncTestDock *)param;
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
 
 	CD_TO_LOCAL(audio_marker_found_s *, data, calldata_get_ptr);
 	audio_marker_found_s found = *data;
 
-	QMetaObject::invokeMethod(dock, [dock, found]() { dock->on_audio_marker_found(found); });
+	QMetaObject::invokeMethod(dock, [dock, id, found]() { dock->on_audio_marker_found(id, found); });
 };
 
 void SyncTestDock::cb_sync_found(void *param, calldata_t *cd)
 {
-	auto *dock = (SyncTestDock *)param;
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
 
 	CD_TO_LOCAL(sync_index *, data, calldata_get_ptr);
 	sync_index found = *data;
 
-	QMetaObject::invokeMethod(dock, [dock, found]() { dock->on_sync_found(found); });
+	QMetaObject::invokeMethod(dock, [dock, id, found]() { dock->on_sync_found(id, found); });
 }
 
-void SyncTestDock::on_start_stop()
+void SyncTestDock::cb_watchdog_changed(void *param, calldata_t *cd)
+{
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
+
+	CD_TO_LOCAL(long long, state, calldata_get_int);
+	CD_TO_LOCAL(long long, baseline, calldata_get_int);
+
+	QMetaObject::invokeMethod(dock, [dock, id, state, baseline]() {
+		dock->on_watchdog_changed(id, (int)state, (int64_t)baseline);
+	});
+}
+
+void SyncTestDock::cb_cadence_updated(void *param, calldata_t *cd)
+{
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
+
+	CD_TO_LOCAL(st_cadence_stats *, data, calldata_get_ptr);
+	st_cadence_stats stats = *data;
+
+	QMetaObject::invokeMethod(dock, [dock, id, stats]() { dock->on_cadence_updated(id, stats); });
+}
+
+void SyncTestDock::cb_glass_latency(void *param, calldata_t *cd)
 {
-	if (!sync_test) /* request to start */ {
-		OBSOutputAutoRelease o = obs_output_create(OUTPUT_ID, "sync-test-output", nullptr, nullptr);
-		if (!o) {
-			blog(LOG_ERROR, "Failed to create sync-test-output.");
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
+
+	CD_TO_LOCAL(st_glass_stats *, data, calldata_get_ptr);
+	st_glass_stats stats = *data;
+
+	QMetaObject::invokeMethod(dock, [dock, id, stats]() { dock->on_glass_latency(id, stats); });
+}
+
+void SyncTestDock::cb_measurement_converged(void *param, calldata_t *cd)
+{
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
+
+	CD_TO_LOCAL(st_convergence_s *, data, calldata_get_ptr);
+	st_convergence_s summary = *data;
+
+	QMetaObject::invokeMethod(dock, [dock, id, summary]() { dock->on_measurement_converged(id, summary); });
+}
+
+/* The output stops by itself when the measurement has converged. */
+void SyncTestDock::cb_output_stop(void *param, calldata_t *)
+{
+	auto *session = (SyncTestSession *)param;
+	auto *dock = session->dock;
+	int id = session->id;
+
+	QMetaObject::invokeMethod(dock, [dock, id]() { dock->on_output_stopped(id); });
+}
+
+void SyncTestDock::cb_frontend_event(enum obs_frontend_event event, void *param)
+{
+	auto *dock = (SyncTestDock *)param;
+
+	switch (event) {
+	case OBS_FRONTEND_EVENT_FINISHED_LOADING:
+	case OBS_FRONTEND_EVENT_SCENE_COLLECTION_CHANGED:
+		dock->update_canvas_list();
+		break;
+	default:
+		break;
+	}
+}
+
+#if LIBOBS_API_VER >= MAKE_SEMANTIC_VERSION(31, 1, 0)
+static bool enum_canvas_cb(void *param, obs_canvas_t *canvas)
+{
+	auto *combo = (QComboBox *)param;
+	const char *name = obs_canvas_get_name(canvas);
+	if (name && *name)
+		combo->addItem(QString::fromUtf8(name), QString::fromUtf8(name));
+	return true;
+}
+#endif
+
+void SyncTestDock::update_canvas_list()
+{
+	QString current = sessionCanvas->currentText();
+	sessionCanvas->clear();
+	sessionCanvas->addItem(obs_module_text("Label.MainCanvas"), QString());
+#if LIBOBS_API_VER >= MAKE_SEMANTIC_VERSION(31, 1, 0)
+	obs_enum_canvases(enum_canvas_cb, sessionCanvas);
+#endif
+	sessionCanvas->setCurrentText(current);
+}
+
+SyncTestSession *SyncTestDock::add_session(const QString &name, int mixer, const QString &canvas)
+{
+	auto *session = new SyncTestSession;
+	session->dock = this;
+	session->id = next_session_id++;
+	session->name = name;
+	session->mixer = mixer;
+	session->canvas = canvas;
+
+	session->item = new QTreeWidgetItem();
+	session->item->setData(0, Qt::UserRole, session->id);
+	sessionList->addTopLevelItem(session->item);
+	sessions.emplace_back(session);
+
+	update_session_item(session);
+	sessionList->setCurrentItem(session->item);
+	return session;
+}
+
+SyncTestSession *SyncTestDock::find_session(int id) const
+{
+	for (auto &session : sessions) {
+		if (session->id == id)
+			return session.get();
+	}
+	return nullptr;
+}
+
+SyncTestSession *SyncTestDock::current_session() const
+{
+	QTreeWidgetItem *item = sessionList->currentItem();
+	if (!item)
+		return nullptr;
+	return find_session(item->data(0, Qt::UserRole).toInt());
+}
+
+void SyncTestDock::on_add_session()
+{
+	QString name = sessionName->text().trimmed();
+	if (name.isEmpty())
+		name = QStringLiteral("%1 %2").arg(obs_module_text("Label.Session")).arg(next_session_id + 1);
+
+	for (auto &session : sessions) {
+		if (session->name == name) {
+			blog(LOG_WARNING, "Session '%s' already exists.", name.toUtf8().constData());
 			return;
 		}
+	}
 
-		last_video_ix = last_audio_ix = -1;
-		missed_video_ix = missed_audio_ix = 0;
-		received_video_ix = received_audio_ix = 0;
-		received_video_index_max = 256;
-		received_audio_index_max = 256;
-		audio_index_max = 256;
+	/* The canvas can also be typed since canvases might be added after the list is updated. */
+	QString canvas = sessionCanvas->currentText().trimmed();
+	if (canvas == QString::fromUtf8(obs_module_text("Label.MainCanvas")))
+		canvas.clear();
 
-		auto *sh = obs_output_get_signal_handler(o);
-		signal_handler_connect(sh, "video_marker_found", cb_video_marker_found, this);
-		signal_handler_connect(sh, "audio_marker_found", cb_audio_marker_found, this);
-		signal_handler_connect(sh, "sync_found", cb_sync_found, this);
+	add_session(name, sessionMixer->currentData().toInt(), canvas);
+	sessionName->clear();
+}
+
+void SyncTestDock::on_remove_session()
+{
+	SyncTestSession *session = current_session();
+	if (!session)
+		return;
+
+	stop_session(session);
+
+	for (auto it = sessions.begin(); it != sessions.end(); it++) {
+		if (it->get() != session)
+			continue;
+		delete sessionList->takeTopLevelItem(sessionList->indexOfTopLevelItem(session->item));
+		sessions.erase(it);
+		break;
+	}
 
-		bool success = obs_output_start(o);
+	on_session_selected();
+}
 
-		if (!success)
-			latencyPolarity->setText(obs_module_text("Display.Polarity.Failure"));
+void SyncTestDock::update_session_item(SyncTestSession *session)
+{
+	QString name = session->name;
+	if (!session->canvas.isEmpty())
+		name += QStringLiteral(" (%1)").arg(session->canvas);
+	if (session->mixer > 0)
+		name += QStringLiteral(" [%1 %2]").arg(obs_module_text("Label.Track")).arg(session->mixer + 1);
+	session->item->setText(0, name);
+	session->item->setText(1, session->latency);
+	session->item->setText(2, session->video_index);
+	session->item->setText(3, session->audio_index);
+
+	if (session == current_session())
+		update_session_display();
+}
 
-		if (startButton)
-			startButton->setText(obs_module_text("Button.Stop"));
+void SyncTestDock::update_session_display()
+{
+	SyncTestSession *session = current_session();
 
-		sync_test = o;
+	startButton->setEnabled(session != nullptr);
+	removeSessionButton->setEnabled(session != nullptr);
+	if (!session)
+		return;
+
+	startButton->setText(obs_module_text(session->output ? "Button.Stop" : "Button.Start"));
+	latencyDisplay->setText(session->latency);
+	latencyPolarity->setText(session->polarity);
+	cadenceDisplay->setText(session->cadence);
+	glassDisplay->setText(session->glass);
+	indexDisplay->setText(session->index);
+	frequencyDisplay->setText(session->frequency);
+	videoIndexDisplay->setText(session->video_index);
+	audioIndexDisplay->setText(session->audio_index);
+	watchdogDisplay->setText(session->watchdog);
+	autoStopDisplay->setText(session->convergence);
+	audioDetectorCombo->setEnabled(!session->output);
+	watchdogCheck->setEnabled(!session->output);
+	watchdogInterval->setEnabled(!session->output);
+	watchdogTolerance->setEnabled(!session->output);
+	autoStopCheck->setEnabled(!session->output);
+	autoStopWidth->setEnabled(!session->output);
+	clapperCheck->setEnabled(!session->output);
+	metricsCheck->setEnabled(!session->output);
+	for (auto *w : clapperRegion)
+		w->setEnabled(!session->output);
+}
+
+void SyncTestDock::on_session_selected()
+{
+	update_session_display();
+
+	SyncTestSession *session = current_session();
+	if (session && session->output && perfToggle->isChecked()) {
+		update_stats();
+		perfTimer->start();
+	}
+	else {
+		perfTimer->stop();
+	}
+}
+
+/* The preset is applied to the running session, too. */
+void SyncTestDock::on_preset_changed()
+{
+	SyncTestSession *session = current_session();
+	if (!session || !session->output)
+		return;
+
+	OBSDataAutoRelease settings = obs_data_create();
+	obs_data_set_string(settings, "preset", presetCombo->currentData().toString().toUtf8().constData());
+	obs_output_update(session->output, settings);
+}
+
+void SyncTestDock::on_start_stop()
+{
+	SyncTestSession *session = current_session();
+	if (!session)
+		return;
+
+	if (!session->output) /* request to start */ {
+		start_session(session);
 	}
 	else /* request to stop */ {
-		obs_output_stop(sync_test);
-		sync_test = nullptr;
+		update_stats();
+		stop_session(session);
+	}
+
+	update_session_item(session);
+	on_session_selected();
+}
+
+/* Returns the path of the file of the session such as the journal, one file for each session name.
+ * If a character has to be replaced, the hash of the name is appended so that such as "a b" and "a_b" do not share
+ * the file. */
+static std::string session_file_path(const char *prefix, const QString &name)
+{
+	std::string file = prefix;
+	bool replaced = false;
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (char c : name.toStdString()) {
+		const bool keep = isalnum((unsigned char)c) || c == '-';
+		file += keep ? c : '_';
+		replaced |= !keep;
+		hash = (hash ^ (uint8_t)c) * 16777619u;
+	}
+	if (replaced) {
+		char buf[16];
+		snprintf(buf, sizeof(buf), "-%08x", (unsigned int)hash);
+		file += buf;
+	}
+	file += ".bin";
 
-		if (startButton)
-			startButton->setText(obs_module_text("Button.Start"));
+	char *dir = obs_module_config_path("");
+	if (dir) {
+		os_mkdirs(dir);
+		bfree(dir);
 	}
+
+	char *path = obs_module_config_path(file.c_str());
+	if (!path)
+		return std::string();
+	std::string ret = path;
+	bfree(path);
+	return ret;
+}
+
+void SyncTestDock::start_session(SyncTestSession *session)
+{
+	OBSDataAutoRelease settings = obs_data_create();
+	obs_data_set_int(settings, "audio_detector", audioDetectorCombo->currentData().toInt());
+	obs_data_set_string(settings, "preset", presetCombo->currentData().toString().toUtf8().constData());
+	obs_data_set_string(settings, "journal_path", session_file_path("journal-", session->name).c_str());
+	if (metricsCheck->isChecked())
+		obs_data_set_string(settings, "metrics_path", session_file_path("metrics-", session->name).c_str());
+	obs_data_set_bool(settings, "watchdog", watchdogCheck->isChecked());
+	obs_data_set_int(settings, "watchdog_interval_ms", watchdogInterval->value() * 1000);
+	obs_data_set_int(settings, "watchdog_tolerance_ms", watchdogTolerance->value());
+	obs_data_set_bool(settings, "auto_stop", autoStopCheck->isChecked());
+	obs_data_set_double(settings, "auto_stop_ci_ms", autoStopWidth->value());
+	obs_data_set_bool(settings, "clapper", clapperCheck->isChecked());
+	obs_data_set_int(settings, "clapper_roi_x", clapperRegion[0]->value());
+	obs_data_set_int(settings, "clapper_roi_y", clapperRegion[1]->value());
+	obs_data_set_int(settings, "clapper_roi_w", clapperRegion[2]->value());
+	obs_data_set_int(settings, "clapper_roi_h", clapperRegion[3]->value());
+
+	QString output_name = QStringLiteral("sync-test-output: %1").arg(session->name);
+	OBSOutputAutoRelease o = obs_output_create(OUTPUT_ID, output_name.toUtf8().constData(), settings, nullptr);
+	if (!o) {
+		blog(LOG_ERROR, "Failed to create sync-test-output.");
+		return;
+	}
+
+	if (!session->canvas.isEmpty()) {
+#if LIBOBS_API_VER >= MAKE_SEMANTIC_VERSION(31, 1, 0)
+		obs_canvas_t *canvas = obs_get_canvas_by_name(session->canvas.toUtf8().constData());
+		if (!canvas) {
+			blog(LOG_ERROR, "Canvas '%s' is not found.", session->canvas.toUtf8().constData());
+			session->polarity = obs_module_text("Display.Polarity.Failure");
+			return;
+		}
+		obs_output_set_media(o, obs_canvas_get_video(canvas), obs_get_audio());
+		obs_canvas_release(canvas);
+#else
+		blog(LOG_ERROR, "Canvas '%s' requires OBS 31.1 or later.", session->canvas.toUtf8().constData());
+		session->polarity = obs_module_text("Display.Polarity.Failure");
+		return;
+#endif
+	}
+	obs_output_set_mixer(o, (size_t)session->mixer);
+
+	session->last_video_ix = session->last_audio_ix = -1;
+	session->missed_video_ix = session->missed_audio_ix = 0;
+	session->received_video_ix = session->received_audio_ix = 0;
+	session->received_video_index_max = 256;
+	session->received_audio_index_max = 256;
+	session->video_f = 0;
+	session->polarity = "-";
+	session->cadence = "-";
+	session->glass = "-";
+	session->watchdog = watchdogCheck->isChecked() ? obs_module_text("Watchdog.Learning") : "-";
+	session->convergence = autoStopCheck->isChecked() ? obs_module_text("AutoStop.Measuring") : "-";
+
+	auto *sh = obs_output_get_signal_handler(o);
+	signal_handler_connect(sh, "video_marker_found", cb_video_marker_found, session);
+	signal_handler_connect(sh, "audio_marker_found", cb_audio_marker_found, session);
+	signal_handler_connect(sh, "sync_found", cb_sync_found, session);
+	signal_handler_connect(sh, "watchdog_changed", cb_watchdog_changed, session);
+	signal_handler_connect(sh, "cadence_updated", cb_cadence_updated, session);
+	signal_handler_connect(sh, "glass_latency", cb_glass_latency, session);
+	signal_handler_connect(sh, "measurement_converged", cb_measurement_converged, session);
+	signal_handler_connect(sh, "stop", cb_output_stop, session);
+
+	bool success = obs_output_start(o);
+
+	if (!success)
+		session->polarity = obs_module_text("Display.Polarity.Failure");
+
+	session->output = o;
+}
+
+void SyncTestDock::stop_session(SyncTestSession *session)
+{
+	if (!session->output)
+		return;
+
+	obs_output_stop(session->output);
+
+	auto *sh = obs_output_get_signal_handler(session->output);
+	signal_handler_disconnect(sh, "video_marker_found", cb_video_marker_found, session);
+	signal_handler_disconnect(sh, "audio_marker_found", cb_audio_marker_found, session);
+	signal_handler_disconnect(sh, "sync_found", cb_sync_found, session);
+	signal_handler_disconnect(sh, "watchdog_changed", cb_watchdog_changed, session);
+	signal_handler_disconnect(sh, "cadence_updated", cb_cadence_updated, session);
+	signal_handler_disconnect(sh, "glass_latency", cb_glass_latency, session);
+	signal_handler_disconnect(sh, "measurement_converged", cb_measurement_converged, session);
+	signal_handler_disconnect(sh, "stop", cb_output_stop, session);
+
+	session->output = nullptr;
 }
 
 static int missed_markers(int index, int last_index, int max_index)
@@ -185,36 +764,227 @@ static int missed_markers(int index, int last_index, int max_index)
 	return (max_index + index - last_index - 1) % max_index;
 }
 
-void SyncTestDock::on_video_marker_found(struct video_marker_found_s data)
+void SyncTestDock::on_video_marker_found(int id, struct video_marker_found_s data)
 {
+	SyncTestSession *s = find_session(id);
+	if (!s)
+		return;
+
 	const int index = data.qr_data.index;
-	missed_video_ix += missed_markers(index, last_video_ix, received_video_index_max);
-	last_video_ix = index;
-	received_video_index_max = data.qr_data.index_max;
-	received_video_ix++;
-	frequencyDisplay->setText(QStringLiteral("%1 Hz").arg(data.qr_data.f));
-	int missed = missed_video_ix * 100 / (received_video_ix + missed_video_ix);
-	videoIndexDisplay->setText(QStringLiteral("%1 (%2% missed)").arg(index).arg(missed));
+	s->missed_video_ix += missed_markers(index, s->last_video_ix, s->received_video_index_max);
+	s->last_video_ix = index;
+	s->received_video_index_max = data.qr_data.index_max;
+	s->received_video_ix++;
+	s->video_f = data.qr_data.f;
+	s->frequency = QStringLiteral("%1 Hz").arg(data.qr_data.f);
+	int missed = s->missed_video_ix * 100 / (s->received_video_ix + s->missed_video_ix);
+	s->video_index = QStringLiteral("%1 (%2% missed)").arg(index).arg(missed);
+	update_session_item(s);
 }
 
-void SyncTestDock::on_audio_marker_found(struct audio_marker_found_s data)
+void SyncTestDock::on_audio_marker_found(int id, struct audio_marker_found_s data)
 {
+	SyncTestSession *s = find_session(id);
+	if (!s)
+		return;
+
+	/* Other carriers come from the patterns not in the video. */
+	if (s->video_f && data.f != s->video_f)
+		return;
+
 	const int index = data.index;
-	missed_audio_ix += missed_markers(index, last_audio_ix, received_audio_index_max);
-	last_audio_ix = index;
-	received_audio_index_max = data.index_max;
-	received_audio_ix++;
-	int missed = missed_audio_ix * 100 / (received_audio_ix + missed_audio_ix);
-	audioIndexDisplay->setText(QStringLiteral("%1 (%2% missed)").arg(index).arg(missed));
+	s->missed_audio_ix += missed_markers(index, s->last_audio_ix, s->received_audio_index_max);
+	s->last_audio_ix = index;
+	s->received_audio_index_max = data.index_max;
+	s->received_audio_ix++;
+	int missed = s->missed_audio_ix * 100 / (s->received_audio_ix + s->missed_audio_ix);
+	s->audio_index = QStringLiteral("%1 (%2% missed)").arg(index).arg(missed);
+	update_session_item(s);
 }
 
-void SyncTestDock::on_sync_found(sync_index data)
+void SyncTestDock::on_sync_found(int id, sync_index data)
 {
+	SyncTestSession *s = find_session(id);
+	if (!s)
+		return;
+
 	int64_t ts = (int64_t)data.audio_ts - (int64_t)data.video_ts;
-	latencyDisplay->setText(QStringLiteral("%1 ms").arg(ts * 1e-6, 2, 'f', 1));
-	indexDisplay->setText(QStringLiteral("%1").arg(data.index));
+	s->latency = QStringLiteral("%1 ms").arg(ts * 1e-6, 2, 'f', 1);
+	s->index = QStringLiteral("%1").arg(data.index);
 	if (ts > 0)
-		latencyPolarity->setText(obs_module_text("Display.Polarity.Positive"));
+		s->polarity = obs_module_text("Display.Polarity.Positive");
 	else if (ts < 0)
-		latencyPolarity->setText(obs_module_text("Display.Polarity.Negative"));
+		s->polarity = obs_module_text("Display.Polarity.Negative");
+	update_session_item(s);
+}
+
+void SyncTestDock::on_watchdog_changed(int id, int state, int64_t baseline)
+{
+	SyncTestSession *s = find_session(id);
+	if (!s)
+		return;
+
+	switch (state) {
+	case ST_WATCHDOG_LEARNING:
+		s->watchdog = obs_module_text("Watchdog.Learning");
+		break;
+	case ST_WATCHDOG_SLEEPING:
+	case ST_WATCHDOG_SAMPLING:
+		s->watchdog = QStringLiteral("%1 (%2 ms)")
+				      .arg(obs_module_text("Watchdog.Stable"))
+				      .arg(baseline * 1e-6, 0, 'f', 1);
+		break;
+	case ST_WATCHDOG_ALERT:
+		s->watchdog = obs_module_text("Watchdog.Alert");
+		break;
+	default:
+		s->watchdog = "-";
+		break;
+	}
+	update_session_item(s);
+}
+
+void SyncTestDock::on_cadence_updated(int id, st_cadence_stats data)
+{
+	SyncTestSession *s = find_session(id);
+	if (!s || !data.states)
+		return;
+
+	s->cadence = QString(obs_module_text("Display.Cadence"))
+			     .arg((double)data.frames / (double)data.states, 0, 'f', 2)
+			     .arg(data.expected)
+			     .arg(data.duplicated)
+			     .arg(data.dropped)
+			     .arg(data.gaps)
+			     .arg(data.interval_stddev_ns * 1e-6, 0, 'f', 2)
+			     .arg(data.jitter_max_ns * 1e-6, 0, 'f', 2);
+	update_session_item(s);
+}
+
+void SyncTestDock::on_glass_latency(int id, st_glass_stats data)
+{
+	SyncTestSession *s = find_session(id);
+	if (!s || !data.count)
+		return;
+
+	s->glass = QString(obs_module_text("Display.Glass"))
+			   .arg(data.last_ns * 1e-6, 0, 'f', 1)
+			   .arg(data.p50_ns * 1e-6, 0, 'f', 0)
+			   .arg(data.p95_ns * 1e-6, 0, 'f', 0)
+			   .arg(data.stddev_ns * 1e-6, 0, 'f', 1)
+			   .arg(data.count);
+	update_session_item(s);
+}
+
+void SyncTestDock::on_measurement_converged(int id, st_convergence_s data)
+{
+	SyncTestSession *s = find_session(id);
+	if (!s)
+		return;
+
+	/* Other carriers come from the patterns not in the video. */
+	if (s->video_f && data.f && data.f != s->video_f)
+		return;
+
+	s->convergence = QString(obs_module_text("Display.Converged"))
+				 .arg(data.mean_ns * 1e-6, 0, 'f', 2)
+				 .arg(data.ci_ns * 0.5e-6, 0, 'f', 2)
+				 .arg(data.count);
+	update_session_item(s);
+}
+
+/* Also called after the stop requested from the dock, then the session is already stopped. */
+void SyncTestDock::on_output_stopped(int id)
+{
+	SyncTestSession *s = find_session(id);
+	if (!s || !s->output)
+		return;
+
+	if (s == current_session())
+		update_stats();
+	stop_session(s);
+
+	update_session_item(s);
+	if (s == current_session())
+		on_session_selected();
+}
+
+void SyncTestDock::on_perf_toggled(bool checked)
+{
+	perfToggle->setArrowType(checked ? Qt::DownArrow : Qt::RightArrow);
+	perfWidget->setVisible(checked);
+
+	SyncTestSession *session = current_session();
+	if (checked && session && session->output) {
+		update_stats();
+		perfTimer->start();
+	}
+	else {
+		perfTimer->stop();
+	}
+}
+
+void SyncTestDock::update_stats()
+{
+	SyncTestSession *session = current_session();
+	if (!session || !session->output || !perfWidget->isVisible())
+		return;
+
+	struct st_stats stats;
+	uint8_t stack[128];
+	struct calldata cd;
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_ptr(&cd, "data", &stats);
+	if (!proc_handler_call(obs_output_get_proc_handler(session->output), "get_stats", &cd))
+		return;
+
+	if (!stats.elapsed_ns)
+		return;
+
+	for (int i = 0; i < ST_STAGE_COUNT; i++) {
+		const struct st_stage_stats &s = stats.stages[i];
+		if (!s.count) {
+			perfStageDisplay[i]->setText("-");
+			continue;
+		}
+		double avg_us = s.total_ns * 1e-3 / s.count;
+		double p99_us = s.percentile_ns(0.99f) * 1e-3;
+		double share = s.total_ns * 100.0 / stats.elapsed_ns;
+		perfStageDisplay[i]->setText(QStringLiteral("%1 µs (p99 %2 µs), %3%")
+						     .arg(avg_us, 0, 'f', 1)
+						     .arg(p99_us, 0, 'f', 0)
+						     .arg(share, 0, 'f', 2));
+	}
+
+	perfVideoFramesDisplay->setText(QStringLiteral("%1 (%2 skipped)")
+						.arg(stats.video_frames)
+						.arg(stats.video_frames_skipped));
+	QString runs;
+	for (int i = 0; i < ST_REPEAT_RUN_BUCKETS; i++) {
+		if (!stats.video_repeat_runs[i])
+			continue;
+		if (!runs.isEmpty())
+			runs += QStringLiteral(", ");
+		runs += QStringLiteral("%1%2: %3")
+				.arg(i + 1)
+				.arg(i == ST_REPEAT_RUN_BUCKETS - 1 ? QStringLiteral("+") : QString())
+				.arg(stats.video_repeat_runs[i]);
+	}
+	perfRepeatedDisplay->setText(QStringLiteral("%1 (%2 FPS source; runs %3)")
+					     .arg(stats.video_frames_repeated)
+					     .arg(stats.source_frame_rate(), 0, 'f', 2)
+					     .arg(runs.isEmpty() ? QStringLiteral("-") : runs));
+	perfAudioPacketsDisplay->setText(QStringLiteral("%1 (%2 skipped)")
+						 .arg(stats.audio_packets)
+						 .arg(stats.audio_packets_skipped));
+	perfAudioContinuityDisplay->setText(QStringLiteral("%1 jumps, %2 dropped, %3 inserted, %4 CRC errors")
+						    .arg(stats.audio_discontinuities)
+						    .arg(stats.audio_samples_dropped)
+						    .arg(stats.audio_samples_inserted)
+						    .arg(stats.audio_crc_errors));
+	perfQrScaleDisplay->setText(QStringLiteral("1/%1 (%2 decoded, %3 cached)")
+					    .arg(stats.qr_step)
+					    .arg(stats.qr_decodes)
+					    .arg(stats.qr_cache_hits));
+	perfTotalDisplay->setText(QStringLiteral("%1%").arg(stats.total_ns() * 100.0 / stats.elapsed_ns, 0, 'f', 2));
 }
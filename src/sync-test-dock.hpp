@@ -1,10 +1,56 @@
 #pragma once
+#include <memory>
+#include <vector>
 #include <QFrame>
 #include <QPushButton>
 #include <QLabel>
+#include <QLineEdit>
+#include <QToolButton>
+#include <QComboBox>
+#include <QCheckBox>
+#include <QSpinBox>
+#include <QDoubleSpinBox>
+#include <QTimer>
+#include <QTreeWidget>
 #include <obs.hpp>
+#include <obs-frontend-api.h>
 #include "sync-test-output.hpp"
 
+class SyncTestDock;
+
+/* One measurement with its own output and results. */
+struct SyncTestSession
+{
+	SyncTestDock *dock = nullptr;
+	int id = 0;
+	QString name;
+	int mixer = 0;
+	QString canvas; // empty for the main canvas
+	OBSOutput output;
+	QTreeWidgetItem *item = nullptr;
+
+	int last_video_ix = -1;
+	int last_audio_ix = -1;
+	int missed_video_ix = 0;
+	int missed_audio_ix = 0;
+	int received_video_ix = 0;
+	int received_audio_ix = 0;
+	int received_video_index_max = 256;
+	int received_audio_index_max = 256;
+	uint32_t video_f = 0; // carrier of the pattern shown in the video
+
+	QString latency = "-";
+	QString polarity = "-";
+	QString cadence = "-";
+	QString glass = "-";
+	QString index = "-";
+	QString frequency = "-";
+	QString video_index = "-";
+	QString audio_index = "-";
+	QString watchdog = "-";
+	QString convergence = "-";
+};
+
 class SyncTestDock : public QFrame {
 	Q_OBJECT
 
@@ -17,33 +63,81 @@ private:
 
 	QLabel *latencyDisplay = nullptr;
 	QLabel *latencyPolarity = nullptr;
+	QLabel *cadenceDisplay = nullptr;
+	QLabel *glassDisplay = nullptr;
 	QLabel *indexDisplay = nullptr;
 	QLabel *frequencyDisplay = nullptr;
 	QLabel *videoIndexDisplay = nullptr;
 	QLabel *audioIndexDisplay = nullptr;
+	QComboBox *audioDetectorCombo = nullptr;
+	QComboBox *presetCombo = nullptr;
+	QLabel *watchdogDisplay = nullptr;
+	QCheckBox *watchdogCheck = nullptr;
+	QSpinBox *watchdogInterval = nullptr;
+	QSpinBox *watchdogTolerance = nullptr;
+	QLabel *autoStopDisplay = nullptr;
+	QCheckBox *autoStopCheck = nullptr;
+	QDoubleSpinBox *autoStopWidth = nullptr;
+	QCheckBox *clapperCheck = nullptr;
+	QSpinBox *clapperRegion[4] = {};
+	QCheckBox *metricsCheck = nullptr;
 
-private:
-	OBSOutput sync_test;
+	QTreeWidget *sessionList = nullptr;
+	QLineEdit *sessionName = nullptr;
+	QComboBox *sessionMixer = nullptr;
+	QComboBox *sessionCanvas = nullptr;
+	QPushButton *addSessionButton = nullptr;
+	QPushButton *removeSessionButton = nullptr;
+
+	QToolButton *perfToggle = nullptr;
+	QWidget *perfWidget = nullptr;
+	QLabel *perfStageDisplay[ST_STAGE_COUNT] = {};
+	QLabel *perfVideoFramesDisplay = nullptr;
+	QLabel *perfRepeatedDisplay = nullptr;
+	QLabel *perfAudioPacketsDisplay = nullptr;
+	QLabel *perfAudioContinuityDisplay = nullptr;
+	QLabel *perfQrScaleDisplay = nullptr;
+	QLabel *perfTotalDisplay = nullptr;
+	QTimer *perfTimer = nullptr;
 
 private:
-	int last_video_ix;
-	int last_audio_ix;
-	int missed_video_ix;
-	int missed_audio_ix;
-	int received_video_ix;
-	int received_audio_ix;
-	int received_video_index_max = 0;
-	int received_audio_index_max = 0;
-	int audio_index_max = 0;
+	std::vector<std::unique_ptr<SyncTestSession>> sessions;
+	int next_session_id = 0;
 
 private:
+	SyncTestSession *add_session(const QString &name, int mixer, const QString &canvas);
+	SyncTestSession *find_session(int id) const;
+	SyncTestSession *current_session() const;
+	void start_session(SyncTestSession *session);
+	void stop_session(SyncTestSession *session);
+	void update_session_item(SyncTestSession *session);
+	void update_session_display();
+	void on_session_selected();
+	void update_canvas_list();
+
 	void on_start_stop();
+	void on_preset_changed();
+	void on_add_session();
+	void on_remove_session();
+	void on_perf_toggled(bool checked);
+	void update_stats();
 
-	void on_video_marker_found(video_marker_found_s data);
-	void on_audio_marker_found(audio_marker_found_s data);
-	void on_sync_found(sync_index data);
+	void on_video_marker_found(int id, video_marker_found_s data);
+	void on_audio_marker_found(int id, audio_marker_found_s data);
+	void on_sync_found(int id, sync_index data);
+	void on_watchdog_changed(int id, int state, int64_t baseline);
+	void on_cadence_updated(int id, st_cadence_stats data);
+	void on_glass_latency(int id, st_glass_stats data);
+	void on_measurement_converged(int id, st_convergence_s data);
+	void on_output_stopped(int id);
 
 	static void cb_video_marker_found(void *param, calldata_t *cd);
 	static void cb_audio_marker_found(void *param, calldata_t *cd);
 	static void cb_sync_found(void *param, calldata_t *cd);
+	static void cb_watchdog_changed(void *param, calldata_t *cd);
+	static void cb_cadence_updated(void *param, calldata_t *cd);
+	static void cb_glass_latency(void *param, calldata_t *cd);
+	static void cb_measurement_converged(void *param, calldata_t *cd);
+	static void cb_output_stop(void *param, calldata_t *cd);
+	static void cb_frontend_event(enum obs_frontend_event event, void *param);
 };
@@ -0,0 +1,235 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/util_uint64.h>
+#include <inttypes.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "sync-test-pattern.hpp"
+
+#include "plugin-macros.generated.h"
+
+#define QR_PAYLOAD_SIZE 64
+
+/* Source to generate the pattern of `tool/videogen.py` in real time so that the
+ * latency inside OBS Studio can be measured on one machine without a camera.
+ * The frames and the audio are timestamped in the clock of `os_gettime_ns`
+ * so that `T` in the QR code is the time the first frame of the sync pattern 1
+ * is due. */
+struct sync_test_generator
+{
+	obs_source_t *context;
+
+	st_pattern pattern;
+	bool timecode = true;
+
+	std::thread thread;
+	std::atomic<bool> stopping{false};
+};
+
+static const char *gen_get_name(void *)
+{
+	return obs_module_text("Generator.Name");
+}
+
+static void gen_get_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "q", 4);
+	obs_data_set_default_int(settings, "f", 884);
+	obs_data_set_default_int(settings, "c", 2);
+	obs_data_set_default_int(settings, "protocol", 1);
+	obs_data_set_default_bool(settings, "binary_qr", false);
+	obs_data_set_default_bool(settings, "timecode", true);
+	obs_data_set_default_int(settings, "width", 1280);
+	obs_data_set_default_int(settings, "height", 720);
+}
+
+static obs_properties_t *gen_get_properties(void *)
+{
+	obs_properties_t *props = obs_properties_create();
+	obs_property_t *prop;
+
+	obs_properties_add_int(props, "q", obs_module_text("Generator.Prop.Q"), 1, 60, 1);
+	obs_properties_add_int(props, "f", obs_module_text("Generator.Prop.F"), 10, 20000, 1);
+	obs_properties_add_int(props, "c", obs_module_text("Generator.Prop.C"), 0, 1000, 1);
+
+	prop = obs_properties_add_list(props, "protocol", obs_module_text("Generator.Prop.Protocol"),
+				       OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(prop, obs_module_text("Generator.Prop.Protocol.V1"), 1);
+	obs_property_list_add_int(prop, obs_module_text("Generator.Prop.Protocol.V2"), 2);
+
+	obs_properties_add_bool(props, "binary_qr", obs_module_text("Generator.Prop.BinaryQr"));
+	obs_properties_add_bool(props, "timecode", obs_module_text("Generator.Prop.Timecode"));
+	obs_properties_add_int(props, "width", obs_module_text("Generator.Prop.Width"), 64, 7680, 1);
+	obs_properties_add_int(props, "height", obs_module_text("Generator.Prop.Height"), 64, 4320, 1);
+
+	return props;
+}
+
+static void gen_thread(struct sync_test_generator *g)
+{
+	os_set_thread_name("sync-test-generator");
+
+	const st_pattern &p = g->pattern;
+	const uint32_t cycle = p.cycle_frames();
+
+	/* The sync patterns are rendered once and the QR code once for each cycle. */
+	std::vector<uint8_t> images[3];
+	for (auto &img : images)
+		img.resize((size_t)p.width * p.height);
+	p.render_sync(images[1].data(), p.width, 0);
+	p.render_sync(images[2].data(), p.width, 1);
+
+	struct obs_source_frame frame = {};
+	frame.width = p.width;
+	frame.height = p.height;
+	frame.format = VIDEO_FORMAT_Y800;
+	frame.linesize[0] = p.width;
+	frame.full_range = true;
+	video_format_get_parameters(VIDEO_CS_DEFAULT, VIDEO_RANGE_FULL, frame.color_matrix, frame.color_range_min,
+				    frame.color_range_max);
+
+	std::vector<float> samples;
+	struct obs_source_audio audio = {};
+	audio.speakers = SPEAKERS_MONO;
+	audio.format = AUDIO_FORMAT_FLOAT;
+	audio.samples_per_sec = p.sample_rate;
+
+	st_qrcode qr;
+	const uint64_t start_ts = os_gettime_ns();
+
+	for (uint64_t n = 0; !g->stopping; n++) {
+		const uint64_t k = n / cycle;
+		if (n % cycle == 0) {
+			const uint32_t modulus = p.index_modulus();
+			const uint64_t sync1_ts = start_ts + p.frame_time_ns(k * cycle + p.q * 2);
+			uint8_t payload[QR_PAYLOAD_SIZE];
+			size_t len = p.payload(payload, sizeof(payload), (uint32_t)(k % modulus), modulus,
+					       g->timecode ? sync1_ts / 1000 : 0);
+			if (!len || !qr.encode(payload, len)) {
+				blog(LOG_ERROR, "%s: failed to encode the QR code", obs_source_get_name(g->context));
+				return;
+			}
+			p.render_qrcode(images[0].data(), p.width, qr);
+		}
+
+		const uint64_t ts = start_ts + p.frame_time_ns(n);
+		os_sleepto_ns(ts);
+		if (g->stopping)
+			break;
+
+		frame.data[0] = images[(n % cycle) / p.q].data();
+		frame.timestamp = ts;
+		obs_source_output_video(g->context, &frame);
+
+		/* The audio of the frame covers until the next frame so that the samples are contiguous. */
+		const uint64_t s0 = p.frame_sample(n);
+		samples.resize((size_t)(p.frame_sample(n + 1) - s0));
+		p.audio_fill(samples.data(), s0, samples.size());
+		audio.data[0] = (const uint8_t *)samples.data();
+		audio.frames = (uint32_t)samples.size();
+		audio.timestamp = start_ts + util_mul_div64(s0, 1000000000ULL, p.sample_rate);
+		obs_source_output_audio(g->context, &audio);
+	}
+}
+
+static void gen_stop(struct sync_test_generator *g)
+{
+	if (!g->thread.joinable())
+		return;
+	g->stopping = true;
+	g->thread.join();
+	g->stopping = false;
+}
+
+/* The pattern restarts from the index 0 whenever the settings are changed. */
+static void gen_update(void *data, obs_data_t *settings)
+{
+	auto *g = (struct sync_test_generator *)data;
+	gen_stop(g);
+
+	struct obs_video_info ovi;
+	if (!obs_get_video_info(&ovi)) {
+		blog(LOG_ERROR, "%s: video is not initialized", obs_source_get_name(g->context));
+		return;
+	}
+
+	st_pattern p;
+	p.fps_num = ovi.fps_num;
+	p.fps_den = ovi.fps_den;
+	p.sample_rate = audio_output_get_sample_rate(obs_get_audio());
+	p.width = (uint32_t)obs_data_get_int(settings, "width");
+	p.height = (uint32_t)obs_data_get_int(settings, "height");
+	p.q = (uint32_t)obs_data_get_int(settings, "q");
+	p.f = (uint32_t)obs_data_get_int(settings, "f");
+	p.c = (uint32_t)obs_data_get_int(settings, "c");
+	p.type_flags = obs_data_get_int(settings, "protocol") == 2 ? ST_PATTERN_TYPE_V2 : 0;
+	p.binary_qr = obs_data_get_bool(settings, "binary_qr");
+
+	const char *err = p.setup();
+	if (err) {
+		blog(LOG_ERROR, "%s: cannot generate the pattern: %s", obs_source_get_name(g->context), err);
+		obs_source_output_video(g->context, nullptr);
+		return;
+	}
+
+	g->pattern = p;
+	g->timecode = obs_data_get_bool(settings, "timecode");
+	g->thread = std::thread(gen_thread, g);
+
+	blog(LOG_INFO, "%s: generating %ux%u at %u/%u FPS, q=%u f=%u c=%u t=%u%s%s", obs_source_get_name(g->context),
+	     p.width, p.height, p.fps_num, p.fps_den, p.q, p.f, p.c, p.type_flags, p.binary_qr ? " binary" : "",
+	     g->timecode ? " with timecode" : "");
+}
+
+static void *gen_create(obs_data_t *settings, obs_source_t *source)
+{
+	auto *g = new sync_test_generator;
+	g->context = source;
+
+	gen_update(g, settings);
+
+	return g;
+}
+
+static void gen_destroy(void *data)
+{
+	auto *g = (struct sync_test_generator *)data;
+	gen_stop(g);
+	delete g;
+}
+
+extern "C" void register_sync_test_generator()
+{
+	struct obs_source_info info = {};
+	info.id = GENERATOR_ID;
+	info.type = OBS_SOURCE_TYPE_INPUT;
+	info.output_flags = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_AUDIO;
+	info.get_name = gen_get_name;
+	info.get_defaults = gen_get_defaults;
+	info.create = gen_create;
+	info.destroy = gen_destroy;
+	info.update = gen_update;
+	info.get_properties = gen_get_properties;
+
+	obs_register_source(&info);
+}
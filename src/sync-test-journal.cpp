@@ -0,0 +1,109 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <inttypes.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "sync-test-journal.hpp"
+
+#include "plugin-macros.generated.h"
+
+bool st_journal::open(const char *path, size_t capacity_)
+{
+	close();
+
+	if (!path || !*path || capacity_ == 0)
+		return false;
+
+	size_t size = ST_JOURNAL_HEADER_SIZE + capacity_ * ST_JOURNAL_RECORD_SIZE;
+	bool existed = false;
+	if (!file.open(path, size, &existed)) {
+		blog(LOG_ERROR, "failed to map journal file '%s'", path);
+		return false;
+	}
+	void *map = file.data();
+
+	header = (st_journal_header *)map;
+	records = (st_journal_record *)((uint8_t *)map + ST_JOURNAL_HEADER_SIZE);
+	capacity = capacity_;
+
+	bool compatible = existed && memcmp(header->magic, ST_JOURNAL_MAGIC, 8) == 0 &&
+			  header->version == ST_JOURNAL_VERSION && header->header_size == ST_JOURNAL_HEADER_SIZE &&
+			  header->record_size == ST_JOURNAL_RECORD_SIZE && header->capacity == capacity;
+	if (!compatible) {
+		memset(map, 0, size);
+		memcpy(header->magic, ST_JOURNAL_MAGIC, 8);
+		header->version = ST_JOURNAL_VERSION;
+		header->header_size = ST_JOURNAL_HEADER_SIZE;
+		header->record_size = ST_JOURNAL_RECORD_SIZE;
+		header->capacity = (uint32_t)capacity;
+		header->next_seq = 0;
+	}
+	/* The hint in the header might be behind if the writers raced on it. */
+	uint64_t seq = header->next_seq;
+	for (size_t i = 0; i < capacity; i++)
+		seq = std::max(seq, records[i].seq);
+	next_seq = seq;
+
+	blog(LOG_INFO, "journal '%s' opened with %zu records, continuing from %" PRIu64, path, capacity,
+	     (uint64_t)next_seq);
+
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	st_journal_record r(ST_JOURNAL_START);
+	r.start.realtime_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+	write(r);
+
+	return true;
+}
+
+void st_journal::close()
+{
+	file.close();
+	header = nullptr;
+	records = nullptr;
+}
+
+void st_journal::write(const st_journal_record &src)
+{
+	if (!records)
+		return;
+
+	uint64_t seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+	st_journal_record *r = &records[seq % capacity];
+
+	/* Invalidate the old record first so that a reader never takes a mix of two records as valid. */
+	r->seq = 0;
+	std::atomic_thread_fence(std::memory_order_release);
+
+	r->time_ns = os_gettime_ns();
+	r->type = src.type;
+	r->index = src.index;
+	r->timestamp = src.timestamp;
+	memcpy(r->raw, src.raw, sizeof(r->raw));
+
+	std::atomic_thread_fence(std::memory_order_release);
+	r->seq = seq + 1;
+
+	/* `next_seq` in the header is a hint for the reader; the records are ordered by `seq`. */
+	if (seq + 1 > header->next_seq)
+		header->next_seq = seq + 1;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "sync-test-mmap.hpp"
+
+/* Append-only journal of the detections written to a memory-mapped ring file.
+ * All records have the same size so that writing a record does not need
+ * any allocation or formatting. The file is read by `tool/journal2csv.py`. */
+
+#define ST_JOURNAL_MAGIC "STJRNL01"
+#define ST_JOURNAL_VERSION 1
+#define ST_JOURNAL_HEADER_SIZE 64
+#define ST_JOURNAL_RECORD_SIZE 64
+
+enum st_journal_type {
+	ST_JOURNAL_START = 1,
+	ST_JOURNAL_QRCODE = 2,
+	ST_JOURNAL_VIDEO_MARKER = 3,
+	ST_JOURNAL_AUDIO_MARKER = 4,
+	ST_JOURNAL_SYNC = 5,
+	ST_JOURNAL_AUDIO_DISCONTINUITY = 6,
+	ST_JOURNAL_GLASS_LATENCY = 7,
+	ST_JOURNAL_CONVERGED = 8,
+};
+
+struct st_journal_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t capacity;
+	uint64_t next_seq;
+	uint8_t reserved[32];
+};
+
+struct st_journal_record
+{
+	st_journal_record(enum st_journal_type type_ = ST_JOURNAL_START, uint32_t index_ = 0,
+			  uint64_t timestamp_ = 0)
+		: seq(0), time_ns(0), type((uint32_t)type_), index(index_), timestamp(timestamp_), raw()
+	{
+	}
+
+	uint64_t seq;     // sequence number + 1, written at last; 0 if the record is not complete
+	uint64_t time_ns; // os_gettime_ns when the record was written
+	uint32_t type;
+	uint32_t index;
+	uint64_t timestamp; // timestamp of the event from the start of the output
+	union {
+		struct
+		{
+			int32_t x[4], y[4];
+		} qrcode;
+		struct
+		{
+			float score;
+			uint32_t index_max;
+			uint32_t f, c, q_ms;
+		} video;
+		struct
+		{
+			float score;
+			uint32_t index_max;
+			uint32_t f;
+		} audio;
+		struct
+		{
+			uint64_t video_ts, audio_ts;
+			uint32_t index_max;
+			uint32_t f;
+		} sync;
+		struct
+		{
+			int64_t samples;
+			uint32_t type; // enum st_audio_discontinuity_type
+			uint32_t f;
+		} discontinuity;
+		struct
+		{
+			uint64_t timecode_ns; // `T` of the pattern
+			int64_t latency_ns;
+		} glass;
+		struct
+		{
+			int64_t mean_ns; // `index` is the number of the pairs
+			int64_t stddev_ns;
+			int64_t ci_ns;
+			uint32_t f;
+		} converged;
+		struct
+		{
+			uint64_t realtime_ns; // since the Unix epoch
+		} start;
+		uint8_t raw[32];
+	};
+};
+
+static_assert(sizeof(struct st_journal_header) == ST_JOURNAL_HEADER_SIZE, "unexpected header size");
+static_assert(sizeof(struct st_journal_record) == ST_JOURNAL_RECORD_SIZE, "unexpected record size");
+
+class st_journal {
+public:
+	st_journal() {}
+	~st_journal() { close(); }
+	st_journal(const st_journal &) = delete;
+	st_journal &operator=(const st_journal &) = delete;
+
+	/* Maps the file and continues writing after the last record if the file
+	 * has the same layout. Otherwise, the file is initialized. */
+	bool open(const char *path, size_t capacity);
+	void close();
+	bool is_open() const { return records != nullptr; }
+
+	/* Copies `r` to the next record. `seq` and `time_ns` are filled by this function.
+	 * Can be called from several threads at the same time. */
+	void write(const st_journal_record &r);
+
+private:
+	st_journal_header *header = nullptr;
+	st_journal_record *records = nullptr;
+	size_t capacity = 0;
+	std::atomic<uint64_t> next_seq{0};
+
+	st_mapped_file file;
+};
@@ -0,0 +1,76 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <string.h>
+#include <chrono>
+#include "sync-test-output.hpp"
+#include "sync-test-metrics.hpp"
+
+#include "plugin-macros.generated.h"
+
+static_assert(ST_STAGE_COUNT <= ST_METRICS_MAX_STAGES, "too many stages for the metrics file");
+
+bool st_metrics::open(const char *path, const char *name)
+{
+	close();
+
+	if (!path || !*path)
+		return false;
+
+	bool existed = false;
+	if (!file.open(path, sizeof(st_metrics_layout), &existed)) {
+		blog(LOG_ERROR, "failed to map metrics file '%s'", path);
+		return false;
+	}
+
+	/* A reader might be mapping the file; invalidate the magic first. */
+	auto *l = (st_metrics_layout *)file.data();
+	memset(l->header.magic, 0, sizeof(l->header.magic));
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memset((uint8_t *)l + sizeof(l->header.magic), 0, sizeof(st_metrics_layout) - sizeof(l->header.magic));
+	l->header.version = ST_METRICS_VERSION;
+	l->header.size = (uint32_t)sizeof(st_metrics_layout);
+	l->header.n_stages = ST_STAGE_COUNT;
+	if (name)
+		strncpy(l->header.name, name, ST_METRICS_NAME_SIZE - 1);
+	for (int i = 0; i < ST_STAGE_COUNT; i++)
+		strncpy(l->header.stage_names[i], st_stage_name((enum st_stage)i), ST_METRICS_STAGE_NAME_SIZE - 1);
+
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(l->header.magic, ST_METRICS_MAGIC, sizeof(l->header.magic));
+
+	layout = l;
+	blog(LOG_INFO, "metrics '%s' opened", path);
+	return true;
+}
+
+void st_metrics::close()
+{
+	file.close();
+	layout = nullptr;
+}
+
+uint64_t st_metrics::now_ns()
+{
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
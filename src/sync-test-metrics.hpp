@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "sync-test-mmap.hpp"
+
+/* Fixed-layout file of the current metrics for the external monitoring.
+ * Each section has only one writer thread and is protected by its own
+ * sequence counter; `seq` is odd while the section is being written.
+ * A reader copies the section and retries if `seq` was odd or changed,
+ * so that the reader never blocks the writer.
+ * `updated_ns` is the time of the last update since the Unix epoch.
+ * The file is read by `tool/metrics2prom.py`. */
+
+#define ST_METRICS_MAGIC "STMETR01"
+#define ST_METRICS_VERSION 2
+#define ST_METRICS_MAX_STAGES 8
+#define ST_METRICS_NAME_SIZE 32
+#define ST_METRICS_STAGE_NAME_SIZE 16
+
+struct st_metrics_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t size;
+	uint32_t n_stages;
+	uint32_t reserved0;
+	char name[ST_METRICS_NAME_SIZE]; // name of the output
+	uint8_t reserved[8];
+	char stage_names[ST_METRICS_MAX_STAGES][ST_METRICS_STAGE_NAME_SIZE];
+};
+
+/* Written with the mutex of the output locked */
+struct st_metrics_sync
+{
+	uint64_t seq;
+	uint64_t updated_ns;
+	uint64_t count;
+	int64_t latency_ns;
+	uint64_t video_ts;
+	uint64_t audio_ts;
+	uint32_t index;
+	uint32_t index_max;
+};
+
+struct st_metrics_stage
+{
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+/* Written by the video thread */
+struct st_metrics_video
+{
+	uint64_t seq;
+	uint64_t updated_ns;
+	uint64_t frames;
+	uint64_t frames_skipped;
+	uint64_t frames_repeated;
+	uint64_t qr_decodes;
+	uint64_t qr_cache_hits;
+	uint64_t markers;
+	uint64_t markers_missed;
+	uint32_t qr_step;
+	uint32_t watchdog_state;
+	struct st_metrics_stage stages[ST_METRICS_MAX_STAGES];
+};
+
+/* Written by the audio thread */
+struct st_metrics_audio
+{
+	uint64_t seq;
+	uint64_t updated_ns;
+	uint64_t packets;
+	uint64_t packets_skipped;
+	uint64_t markers;
+	uint64_t markers_missed;
+	uint64_t discontinuities;
+	uint64_t samples_dropped;
+	uint64_t samples_inserted;
+	uint64_t crc_errors;
+};
+
+struct st_metrics_layout
+{
+	struct st_metrics_header header;
+	struct st_metrics_sync sync;
+	struct st_metrics_video video;
+	struct st_metrics_audio audio;
+};
+
+static_assert(sizeof(struct st_metrics_header) == 64 + ST_METRICS_MAX_STAGES * ST_METRICS_STAGE_NAME_SIZE,
+	      "unexpected header size");
+static_assert(sizeof(struct st_metrics_sync) == 56, "unexpected sync section size");
+static_assert(sizeof(struct st_metrics_video) == 80 + ST_METRICS_MAX_STAGES * 24, "unexpected video section size");
+static_assert(sizeof(struct st_metrics_audio) == 80, "unexpected audio section size");
+
+class st_metrics {
+public:
+	st_metrics() {}
+	~st_metrics() { close(); }
+	st_metrics(const st_metrics &) = delete;
+	st_metrics &operator=(const st_metrics &) = delete;
+
+	/* Maps the file and clears all metrics. */
+	bool open(const char *path, const char *name);
+	void close();
+	bool is_open() const { return layout != nullptr; }
+
+	/* Calls `func(section)` between the updates of the sequence counter of the section.
+	 * Only one thread can update the same section at a time. */
+	template<typename section_t, typename func_t> void update(section_t st_metrics_layout::*member, func_t func)
+	{
+		if (!layout)
+			return;
+
+		section_t &s = layout->*member;
+		uint64_t seq = s.seq;
+		store_seq(&s.seq, seq + 1);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		func(s);
+		s.updated_ns = now_ns();
+
+		std::atomic_thread_fence(std::memory_order_release);
+		store_seq(&s.seq, seq + 2);
+	}
+
+private:
+	st_mapped_file file;
+	st_metrics_layout *layout = nullptr;
+
+	static void store_seq(uint64_t *p, uint64_t v) { *(volatile uint64_t *)p = v; }
+	static uint64_t now_ns();
+};
@@ -0,0 +1,125 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <obs-module.h>
+#include <util/platform.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "sync-test-mmap.hpp"
+
+#ifdef _WIN32
+bool st_mapped_file::open(const char *path, size_t size, bool *existed)
+{
+	close();
+
+	wchar_t *wpath = nullptr;
+	if (!os_utf8_to_wcs_ptr(path, 0, &wpath))
+		return false;
+
+	HANDLE hf = CreateFileW(wpath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+				FILE_ATTRIBUTE_NORMAL, nullptr);
+	bfree(wpath);
+	if (hf == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER current;
+	*existed = GetFileSizeEx(hf, &current) && (uint64_t)current.QuadPart == (uint64_t)size;
+
+	HANDLE hm = CreateFileMappingW(hf, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size,
+				       nullptr);
+	if (!hm) {
+		CloseHandle(hf);
+		return false;
+	}
+
+	void *p = MapViewOfFile(hm, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!p) {
+		CloseHandle(hm);
+		CloseHandle(hf);
+		return false;
+	}
+
+	file_handle = hf;
+	map_handle = hm;
+	map = p;
+	map_size = size;
+	return true;
+}
+
+void st_mapped_file::close()
+{
+	if (!map)
+		return;
+
+	FlushViewOfFile(map, 0);
+	UnmapViewOfFile(map);
+	CloseHandle((HANDLE)map_handle);
+	CloseHandle((HANDLE)file_handle);
+	map_handle = file_handle = nullptr;
+	map = nullptr;
+	map_size = 0;
+}
+#else
+bool st_mapped_file::open(const char *path, size_t size, bool *existed)
+{
+	close();
+
+	int f = ::open(path, O_RDWR | O_CREAT, 0644);
+	if (f < 0)
+		return false;
+
+	struct stat st;
+	*existed = fstat(f, &st) == 0 && (uint64_t)st.st_size == (uint64_t)size;
+
+	if (!*existed && ftruncate(f, (off_t)size) != 0) {
+		::close(f);
+		return false;
+	}
+
+	void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+	if (p == MAP_FAILED) {
+		::close(f);
+		return false;
+	}
+
+	fd = f;
+	map = p;
+	map_size = size;
+	return true;
+}
+
+void st_mapped_file::close()
+{
+	if (!map)
+		return;
+
+	munmap(map, map_size);
+	::close(fd);
+	fd = -1;
+	map = nullptr;
+	map_size = 0;
+}
+#endif
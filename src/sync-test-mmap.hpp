@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+/* A file mapped to the memory for read and write, shared with other processes. */
+class st_mapped_file {
+public:
+	st_mapped_file() {}
+	~st_mapped_file() { close(); }
+	st_mapped_file(const st_mapped_file &) = delete;
+	st_mapped_file &operator=(const st_mapped_file &) = delete;
+
+	/* Maps `size` bytes of the file, which is created or resized if necessary.
+	 * `existed` is set if the file already had the same size. */
+	bool open(const char *path, size_t size, bool *existed);
+	void close();
+
+	void *data() const { return map; }
+	size_t size() const { return map_size; }
+
+private:
+	void *map = nullptr;
+	size_t map_size = 0;
+#ifdef _WIN32
+	void *file_handle = nullptr;
+	void *map_handle = nullptr;
+#else
+	int fd = -1;
+#endif
+};
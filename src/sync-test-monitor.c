@@ -20,18 +20,48 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <obs-module.h>
 #include <util/threading.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include "plugin-macros.generated.h"
+#include "sync-test-overlay.h"
 
 #define QR_RECT_COLOR 0xFF00FF00
+#define QR_UNDECODED_COLOR 0xFF00FFFF
+#define MARKER_POSITIVE_COLOR 0xFFFFFF00
+#define MARKER_NEGATIVE_COLOR 0xFFFF00FF
+#define MARKER_INACTIVE_COLOR 0x80808080
+#define TRACE_COLOR 0xFFFFFFFF
+#define TRACE_AXIS_COLOR 0x80FFFFFF
+#define CIRCLE_SEGMENTS 32
+#define TRACE_LENGTH 120
+
+/* The overlay is handed from the video thread to the graphics thread with a
+ * triple buffer. `middle` holds the index of the slot that is not owned by
+ * either thread and `MIDDLE_FRESH` tells the slot has not been read yet.
+ * Neither thread waits for the other. */
+#define MIDDLE_INDEX_MASK 3
+#define MIDDLE_FRESH 4
+
+struct st_monitor_slot
+{
+	struct st_overlay_data overlay;
+	float trace[TRACE_LENGTH]; // oldest first, NAN if the marker was not active
+};
 
 struct st_monitor_s
 {
 	obs_weak_output_t *weak;
+	char *output_name; // empty to bind to the first one
 
-	pthread_mutex_t mutex;
-	int x0, y0, x1, y1, x2, y2, x3, y3;
-	volatile bool got_data;
+	struct st_monitor_slot slots[3];
+	volatile long middle;
+	int back;  // owned by the video thread
+	int front; // owned by the graphics thread
+	bool got_data;
+
+	/* Rolling trace of the marker level, owned by the video thread */
+	float trace[TRACE_LENGTH];
+	int trace_pos;
 };
 
 static const char *get_name(void *type_data)
@@ -40,48 +70,43 @@ static const char *get_name(void *type_data)
 	return obs_module_text("Monitor.Name");
 }
 
+struct find_output_s
+{
+	const char *name;
+	obs_output_t *res;
+};
+
 static bool find_output_cb(void *data, obs_output_t *o)
 {
-	obs_output_t **res = data;
+	struct find_output_s *ctx = data;
 	const char *id = obs_output_get_id(o);
-	if (id && strcmp(id, OUTPUT_ID) == 0) {
-		*res = o;
-		return false;
-	}
-	return true;
+	if (!id || strcmp(id, OUTPUT_ID) != 0)
+		return true;
+
+	if (ctx->name && *ctx->name && strcmp(obs_output_get_name(o), ctx->name) != 0)
+		return true;
+
+	ctx->res = o;
+	return false;
 }
 
-static void cb_qrcode_found(void *param, calldata_t *data)
+static void cb_overlay_update(void *param, calldata_t *cd)
 {
 	struct st_monitor_s *s = param;
-	long long timestamp;
-	if (!calldata_get_int(data, "timestamp", &timestamp))
+	struct st_overlay_data *data;
+	if (!calldata_get_ptr(cd, "data", &data) || !data)
 		return;
 
-	pthread_mutex_lock(&s->mutex);
-#define GET_INT(name)                                     \
-	do {                                              \
-		long long t;                              \
-		if (!calldata_get_int(data, #name, &t)) { \
-			pthread_mutex_unlock(&s->mutex);  \
-			return;                           \
-		}                                         \
-		s->name = (int)t;                         \
-	} while (false);
-
-	GET_INT(x0);
-	GET_INT(y0);
-	GET_INT(x1);
-	GET_INT(y1);
-	GET_INT(x2);
-	GET_INT(y2);
-	GET_INT(x3);
-	GET_INT(y3);
-	pthread_mutex_unlock(&s->mutex);
+	s->trace[s->trace_pos] = data->marker_active ? data->level : NAN;
+	s->trace_pos = (s->trace_pos + 1) % TRACE_LENGTH;
 
-	s->got_data = true;
+	struct st_monitor_slot *slot = &s->slots[s->back];
+	slot->overlay = *data;
+	for (int i = 0; i < TRACE_LENGTH; i++)
+		slot->trace[i] = s->trace[(s->trace_pos + i) % TRACE_LENGTH];
 
-#undef GET_INT
+	long prev = os_atomic_exchange_long(&s->middle, s->back | MIDDLE_FRESH);
+	s->back = prev & MIDDLE_INDEX_MASK;
 }
 
 static void find_output(struct st_monitor_s *s)
@@ -89,14 +114,15 @@ static void find_output(struct st_monitor_s *s)
 	if (s->weak)
 		return;
 
-	obs_output_t *o = NULL;
-	obs_enum_outputs(find_output_cb, &o);
+	struct find_output_s ctx = {s->output_name, NULL};
+	obs_enum_outputs(find_output_cb, &ctx);
+	obs_output_t *o = ctx.res;
 	if (!o)
 		return;
 
 	s->weak = obs_output_get_weak_output(o);
 	signal_handler_t *sh = obs_output_get_signal_handler(o);
-	signal_handler_connect(sh, "qrcode_found", cb_qrcode_found, s);
+	signal_handler_connect(sh, "overlay_update", cb_overlay_update, s);
 }
 
 static void release_output(struct st_monitor_s *s)
@@ -112,17 +138,58 @@ static void release_output(struct st_monitor_s *s)
 		return;
 
 	signal_handler_t *sh = obs_output_get_signal_handler(o);
-	signal_handler_disconnect(sh, "qrcode_found", cb_qrcode_found, s);
+	signal_handler_disconnect(sh, "overlay_update", cb_overlay_update, s);
 	obs_output_release(o);
 }
 
+static void update(void *data, obs_data_t *settings)
+{
+	struct st_monitor_s *s = data;
+	const char *output_name = obs_data_get_string(settings, "output_name");
+
+	if (s->output_name && strcmp(s->output_name, output_name) == 0)
+		return;
+
+	bfree(s->output_name);
+	s->output_name = bstrdup(output_name);
+	release_output(s);
+}
+
+static bool enum_output_names_cb(void *data, obs_output_t *o)
+{
+	obs_property_t *prop = data;
+	const char *id = obs_output_get_id(o);
+	if (id && strcmp(id, OUTPUT_ID) == 0)
+		obs_property_list_add_string(prop, obs_output_get_name(o), obs_output_get_name(o));
+	return true;
+}
+
+static obs_properties_t *get_properties(void *data)
+{
+	UNUSED_PARAMETER(data);
+	obs_properties_t *props = obs_properties_create();
+	obs_property_t *prop;
+
+	prop = obs_properties_add_list(props, "output_name", obs_module_text("Monitor.Prop.Session"),
+				       OBS_COMBO_TYPE_EDITABLE, OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(prop, obs_module_text("Monitor.Prop.Session.First"), "");
+	obs_enum_outputs(enum_output_names_cb, prop);
+
+	return props;
+}
+
 static void *create(obs_data_t *settings, obs_source_t *source)
 {
-	UNUSED_PARAMETER(settings);
 	UNUSED_PARAMETER(source);
 	struct st_monitor_s *s = bzalloc(sizeof(struct st_monitor_s));
 
-	pthread_mutex_init(&s->mutex, NULL);
+	s->front = 0;
+	s->middle = 1;
+	s->back = 2;
+	for (int i = 0; i < TRACE_LENGTH; i++)
+		s->trace[i] = NAN;
+
+	update(s, settings);
 
 	return s;
 }
@@ -134,8 +201,7 @@ static void destroy(void *data)
 	if (s->weak)
 		release_output(s);
 
-	pthread_mutex_destroy(&s->mutex);
-
+	bfree(s->output_name);
 	bfree(s);
 }
 
@@ -178,29 +244,89 @@ static void video_tick(void *data, float seconds)
 	}
 }
 
+static void draw_quad(const int *x, const int *y)
+{
+	gs_render_start(false);
+	for (int i = 0; i <= ST_OVERLAY_CORNERS; i++)
+		gs_vertex2f((float)x[i % ST_OVERLAY_CORNERS], (float)y[i % ST_OVERLAY_CORNERS]);
+	gs_render_stop(GS_LINESTRIP);
+}
+
+static void draw_circle(float x, float y, float r)
+{
+	gs_render_start(false);
+	for (int i = 0; i <= CIRCLE_SEGMENTS; i++) {
+		float a = (float)(2.0 * M_PI) * (float)i / CIRCLE_SEGMENTS;
+		gs_vertex2f(x + r * cosf(a), y + r * sinf(a));
+	}
+	gs_render_stop(GS_LINESTRIP);
+}
+
+static void draw_trace(const float *trace, float x0, float y0, float w, float h)
+{
+	bool started = false;
+	for (int i = 0; i < TRACE_LENGTH; i++) {
+		if (isnan(trace[i])) {
+			if (started)
+				gs_render_stop(GS_LINESTRIP);
+			started = false;
+			continue;
+		}
+		if (!started)
+			gs_render_start(false);
+		started = true;
+		gs_vertex2f(x0 + w * (float)i / (TRACE_LENGTH - 1), y0 + h * 0.5f * (1.0f - trace[i]));
+	}
+	if (started)
+		gs_render_stop(GS_LINESTRIP);
+}
+
 static void video_render(void *data, gs_effect_t *effect)
 {
 	UNUSED_PARAMETER(effect);
 	struct st_monitor_s *s = data;
 
-	if (s->got_data) {
-		pthread_mutex_lock(&s->mutex);
-		int x0 = s->x0, y0 = s->y0;
-		int x1 = s->x1, y1 = s->y1;
-		int x2 = s->x2, y2 = s->y2;
-		int x3 = s->x3, y3 = s->y3;
-		pthread_mutex_unlock(&s->mutex);
-
-		gs_effect_t *e = obs_get_base_effect(OBS_EFFECT_SOLID);
-		gs_effect_set_color(gs_effect_get_param_by_name(e, "color"), QR_RECT_COLOR);
-		while (gs_effect_loop(e, "Solid")) {
+	if (os_atomic_load_long(&s->middle) & MIDDLE_FRESH) {
+		long prev = os_atomic_exchange_long(&s->middle, s->front);
+		s->front = prev & MIDDLE_INDEX_MASK;
+		s->got_data = true;
+	}
+
+	if (!s->got_data)
+		return;
+
+	const struct st_monitor_slot *slot = &s->slots[s->front];
+	const struct st_overlay_data *ov = &slot->overlay;
+
+	gs_effect_t *e = obs_get_base_effect(OBS_EFFECT_SOLID);
+	gs_eparam_t *color = gs_effect_get_param_by_name(e, "color");
+	while (gs_effect_loop(e, "Solid")) {
+		for (int i = 0; i < ov->n_codes; i++) {
+			const struct st_overlay_code *c = &ov->codes[i];
+			gs_effect_set_color(color, c->decoded ? QR_RECT_COLOR : QR_UNDECODED_COLOR);
+			draw_quad(c->x, c->y);
+		}
+
+		if (ov->has_marker) {
+			for (int i = 0; i < ST_OVERLAY_CORNERS; i++) {
+				uint32_t c = (i & 1) ? MARKER_POSITIVE_COLOR : MARKER_NEGATIVE_COLOR;
+				gs_effect_set_color(color, ov->marker_active ? c : MARKER_INACTIVE_COLOR);
+				draw_circle((float)ov->marker_x[i], (float)ov->marker_y[i], (float)ov->marker_r);
+			}
+		}
+
+		uint32_t w = get_width(s), h = get_height(s);
+		if (w && h) {
+			float tw = (float)w / 4.0f, th = (float)h / 8.0f;
+			float tx = (float)w / 64.0f, ty = (float)h - th - (float)h / 64.0f;
+			gs_effect_set_color(color, TRACE_AXIS_COLOR);
 			gs_render_start(false);
-			gs_vertex2f((float)x0, (float)y0);
-			gs_vertex2f((float)x1, (float)y1);
-			gs_vertex2f((float)x2, (float)y2);
-			gs_vertex2f((float)x3, (float)y3);
-			gs_vertex2f((float)x0, (float)y0);
+			gs_vertex2f(tx, ty + th * 0.5f);
+			gs_vertex2f(tx + tw, ty + th * 0.5f);
 			gs_render_stop(GS_LINESTRIP);
+
+			gs_effect_set_color(color, TRACE_COLOR);
+			draw_trace(slot->trace, tx, ty, tw, th);
 		}
 	}
 }
@@ -214,6 +340,8 @@ void register_sync_test_monitor(bool list)
 		.get_name = get_name,
 		.create = create,
 		.destroy = destroy,
+		.update = update,
+		.get_properties = get_properties,
 		.video_tick = video_tick,
 		.video_render = video_render,
 		.get_width = get_width,
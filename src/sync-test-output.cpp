@@ -25,9 +25,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <algorithm>
 #include <mutex>
 #include <complex>
+#include <vector>
+#include <memory>
 #include "quirc.h"
 #include "sync-test-output.hpp"
+#include "sync-test-overlay.h"
+#include "sync-test-stats.hpp"
+#include "sync-test-pool.hpp"
+#include "sync-test-journal.hpp"
+#include "sync-test-metrics.hpp"
 #include "peak-finder.hpp"
+#include "matched-filter.hpp"
+#include "clapper.hpp"
+#include "cadence.hpp"
+#include "audio-continuity.hpp"
+#include "glass-latency.hpp"
+#include "convergence.hpp"
+#include "luma-pyramid.hpp"
 
 #include "plugin-macros.generated.h"
 
@@ -36,13 +50,103 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define N_AUDIO_SYMBOLS 16
 #define N_SYMBOL_BUFFER 20
 
-/* There are several reason to limit the width and the height.
- * - Since a square of 3/8 QR-code-length is calculated using uint32_t,
- *   the 3/8 of width or height cannot exceed the square root of uint32_t max.
- * - Since a sum of the pixels in a line is accumurated on uint32_t,
- *   the width must be less than 1/255 of uint32_t max.
- *   */
-#define MAX_WIDTH_HEIGHT 87378u
+/* Number of the data symbols following the preamble; index and CRC */
+#define N_DATA_SYMBOLS_V1 6
+#define N_DATA_SYMBOLS_V2 12
+
+/* The template of the matched filter has silent symbols before the preamble
+ * so that a preamble-like pattern inside a continuous tone is not matched. */
+#define MF_SILENT_SYMBOLS 2
+#define MF_PREAMBLE_SYMBOLS 4
+#define MF_SMOOTH_CYCLES 0.25f
+
+/* Up to QR_MAX_SUBSAMPLES x QR_MAX_SUBSAMPLES pixels are averaged into one pixel of the level of the pyramid.
+ * The level is filled in tiles of QR_TILE_WIDTH pixels so that the accumulator stays in L1 cache. */
+#define QR_MAX_SUBSAMPLES 4
+#define QR_TILE_WIDTH 512
+
+/* The QR code is decoded on one level of the luma pyramid, where level `l`
+ * is downscaled by 2^l. The finest level is limited by QR_MAX_AREA and the
+ * coarsest level by QR_MIN_AREA. */
+#define QR_MAX_LEVELS ST_LUMA_MAX_LEVELS
+#define QR_MAX_AREA (1920u * 1088u)
+#define QR_MIN_AREA (320u * 240u)
+
+/* The level is chosen so that a module of the QR code has at least this
+ * size in pixels on the level. */
+#define QR_MIN_MODULE_PIXELS 3.0f
+
+/* If the radius of the marker circle is larger than this value,
+ * the circle is summed on a coarser level of the luma pyramid or the lines
+ * and the pixels are sampled sparsely so that the cost does not grow with
+ * the resolution. A level is not used if the radius becomes less than
+ * MARKER_MIN_RADIUS on it. */
+#define MARKER_MAX_RADIUS 128
+#define MARKER_MIN_RADIUS 16
+
+/* Number of the samples to detect repeated frames.
+ * The samples are taken from a grid over the whole frame and from a grid over the QR code. */
+#define DUP_GRID_X 64
+#define DUP_GRID_Y 36
+#define DUP_ROI_GRID 16
+
+/* A band processed by a worker has at least this number of lines. */
+#define MIN_BAND_LINES 32
+
+/* Number of consecutive latencies within the tolerance to start sleeping in the watchdog mode. */
+#define WATCHDOG_STABLE_SYNCS 3
+
+/* The clapperboard mode samples up to this number of pixels in each direction of the region.
+ * A luma step smaller than CLAPPER_MIN_STEP in 8-bit levels is not an event.
+ * Events in each of video and audio are at least CLAPPER_HOLD_NS apart so that
+ * the end of a flash or the echo of a clap is not taken as another event. */
+#define CLAPPER_ROI_SAMPLES 256
+#define CLAPPER_MIN_STEP 12.0f
+#define CLAPPER_MIN_FLUX 0.02f
+#define CLAPPER_HOLD_NS 1000000000ULL
+
+/* Patterns of different carriers, such as several cameras filming their own
+ * pattern, are demodulated together in one pass over each audio packet.
+ * A carrier is dropped when its QR code has not been found for a while. */
+#define AUDIO_MAX_CARRIERS 4
+#define AUDIO_CARRIER_EXPIRE_NS 60000000000ULL
+
+/* Interval to update the video and audio sections of the metrics file */
+#define METRICS_INTERVAL_NS 250000000ULL
+
+/* If `analysis_threads` is 0, the frame is split into bands only when the
+ * canvas is as large as 4K. */
+#define AUTO_THREADS_MIN_PIXELS (3840u * 2160u)
+#define AUTO_THREADS_MAX 4
+
+/* The audio is averaged over up to this number of samples before demodulation. */
+#define AUDIO_MAX_DECIMATION 8
+
+/* The oscillators of the demodulation are set to the exact phase every this number of samples
+ * so that the rotation in single precision does not drift. */
+#define AUDIO_OSC_BLOCK 64
+
+/* Parameters trading the CPU usage for the precision.
+ * A preset gives all of them and each setting can override its own value. */
+struct st_tuning
+{
+	uint64_t qr_max_area;
+	bool qr_sparse;
+	uint32_t audio_decimation;
+	uint32_t sync_list_size;
+};
+
+static const struct
+{
+	const char *name;
+	struct st_tuning tuning;
+} st_presets[] = {
+	{"low_cpu", {1280u * 720u, true, 4, 32}},
+	{"balanced", {QR_MAX_AREA, false, 1, 128}},
+	{"high_precision", {3840u * 2160u, false, 1, 256}},
+};
+
+#define ST_PRESET_DEFAULT 1
 
 struct st_audio_buffer
 {
@@ -83,6 +187,38 @@ std::complex<float> int16_to_complex(std::pair<int32_t, int32_t> x)
 	return std::complex<float>((float)x.first / 32768.0f, (float)x.second / 32768.0f);
 }
 
+/* Audio pattern decoded from the QR code */
+struct st_audio_pattern
+{
+	uint32_t f = 0;
+	uint32_t c = 0;
+	uint32_t q_ms = 0;
+	uint32_t type_flags = 0;
+	uint64_t last_ts = 0;
+};
+
+/* Demodulator state of one carrier, only accessed by the audio thread */
+struct st_audio_carrier
+{
+	/* `f` is 0 if the carrier is not used. */
+	uint32_t f = 0;
+	uint32_t c = 0;
+	uint32_t type_flags = 0;
+
+	struct st_audio_buffer buffer;
+	struct peak_finder marker_finder;
+	struct matched_filter mf;
+
+	int last_index = -1;
+	uint32_t last_index_max = 256;
+
+	/* Added to the timestamps of the detector so that a decimated baseband gives
+	 * the same timestamps as the baseband at the input rate. */
+	uint64_t detector_shift_ns = 0;
+
+	struct st_carrier_slip slip;
+};
+
 struct corner_type
 {
 	uint32_t x, y;
@@ -102,22 +238,60 @@ struct sync_test_output
 	uint32_t audio_sample_rate = 0;
 	size_t audio_channels = 0;
 
+	/* Tuning set by `update`, guarded by `mutex`.
+	 * The video and audio threads take it at the next frame or packet. */
+	struct st_tuning tuning = {};
+	std::atomic<bool> tuning_video_changed{false};
+	std::atomic<bool> tuning_audio_changed{false};
+
 	/* Sync pattern detection from video */
 	uint64_t start_ts = 0;
 
-	struct quirc *qr = nullptr;
-	uint32_t qr_step;
+	struct quirc *qr_levels[QR_MAX_LEVELS] = {};
+	struct st_luma_pyramid luma;
+	uint64_t qr_max_area = QR_MAX_AREA;
+	int qr_level_min = 0, qr_level_max = 0;
+	int qr_level = 0;
+	bool qr_locked = false;
+	uint64_t qr_last_found_ts = 0;
+
+	/* Sparse scheduling skips decoding the QR code until the next one can appear. */
+	bool qr_sparse = false;
+	uint64_t qr_next_decode_ts = 0;
+	std::atomic<uint32_t> qr_step{1};
+
+	/* The last decoded grid of the QR code and its data */
+	bool qr_cache_valid = false;
+	uint64_t qr_cache_hash = 0;
+	int qr_cache_size = 0;
+	uint8_t qr_cache_cells[QUIRC_MAX_BITMAP];
+	st_qr_data qr_cache_data;
 	struct corner_type qr_corners[N_CORNERS];
 	st_qr_data qr_data;
 
 	int64_t video_level_prev = 0;
 	uint64_t video_level_prev_ts = 0;
+
+	/* Repeated frame detection */
+	bool skip_repeated_frames = true;
+	bool dup_valid = false;
+	uint64_t dup_hash = 0;
+	uint32_t dup_run = 0;
+	double video_frame_rate = 0.0;
 	uint64_t video_marker_max_ts = 0;
 
+	/* Delivered frame cadence, only accessed by the video thread */
+	struct st_cadence_analyzer cadence;
+
+	/* Glass-to-glass latency from the timecode, only accessed by the video thread */
+	struct st_glass_analyzer glass;
+
+	/* Analysis state of the last frame for `overlay_update` */
+	struct st_overlay_data overlay = {};
+
 	/* Sync pattern detection from audio */
-	struct st_audio_buffer audio_buffer;
-	struct peak_finder audio_marker_finder;
-	uint32_t last_audio_index_max = 256;
+	int audio_detector = ST_AUDIO_DETECTOR_ENERGY;
+	struct st_audio_carrier carriers[AUDIO_MAX_CARRIERS];
 
 	/* Multiplex sync pattern detection result */
 	std::list<struct sync_index> sync_indices;
@@ -125,40 +299,244 @@ struct sync_test_output
 	std::mutex mutex;
 
 	/* Audio pattern information from video to audio */
-	uint32_t f = 0;
-	uint32_t c = 0;
-	uint32_t q_ms = 0;
-
-	uint32_t f_last = 0;
-	uint32_t c_last = 0;
+	struct st_audio_pattern patterns[AUDIO_MAX_CARRIERS];
+
+	/* Real parts of all carriers followed by imaginary parts for each baseband sample.
+	 * A baseband sample is the mean of `audio_decimation` input samples, ending at the input sample
+	 * `audio_baseband_first` of the packet for the first one. A partial group continues to the next packet. */
+	std::vector<int16_t> audio_baseband;
+	size_t audio_baseband_n = 0;
+	uint32_t audio_baseband_first = 0;
+	uint32_t audio_decimation = 1;
+	uint32_t audio_baseband_rate = 0;
+	uint32_t audio_decim_n = 0;
+	float audio_decim_re[AUDIO_MAX_CARRIERS] = {};
+	float audio_decim_im[AUDIO_MAX_CARRIERS] = {};
+
+	/* Continuity of the audio, only accessed by the audio thread except the counters */
+	struct st_audio_timestamp_check audio_ts_check;
+	std::atomic<uint64_t> audio_discontinuities{0};
+	std::atomic<uint64_t> audio_samples_dropped{0};
+	std::atomic<uint64_t> audio_samples_inserted{0};
+	std::atomic<uint64_t> audio_crc_errors{0};
+
+	/* Band-split analysis */
+	int analysis_threads = 0;
+	size_t n_threads = 1;
+	std::shared_ptr<st_worker_pool> pool;
+	std::vector<int64_t> marker_partial_sums;
+
+	/* Record of all detections */
+	st_journal journal;
+
+	/* Current metrics for the external monitoring.
+	 * The counters of the markers are only accessed by the video or audio thread. */
+	st_metrics metrics;
+	uint64_t metrics_video_ts = 0;
+	uint64_t metrics_audio_ts = 0;
+	uint64_t video_markers = 0;
+	uint64_t video_markers_missed = 0;
+	int video_last_index = -1;
+	uint32_t video_last_index_max = 0;
+	uint64_t audio_markers = 0;
+	uint64_t audio_markers_missed = 0;
+
+	/* Clapperboard mode; the region is in percent of the frame */
+	bool clapper = false;
+	int clapper_roi[4] = {0, 0, 100, 100};
+	uint64_t clapper_window_ns = 0;
+	uint32_t clapper_x0 = 0, clapper_y0 = 0, clapper_x1 = 0, clapper_y1 = 0;
+	float clapper_level_prev = -1.0f;
+	struct st_onset_threshold clapper_video_th;
+	struct peak_finder clapper_video_finder;
+	struct st_spectral_flux clapper_flux;
+	uint64_t clapper_flux_samples = 0;
+	struct st_onset_threshold clapper_audio_th;
+	struct peak_finder clapper_audio_finder;
+	uint64_t clapper_video_last = 0;
+	uint64_t clapper_audio_last = 0;
+	uint64_t clapper_video_ts = 0; // guarded by `mutex`, waiting for the audio event
+	uint64_t clapper_audio_ts = 0; // guarded by `mutex`, waiting for the video event
+	int clapper_count = 0;
+
+	/* Watchdog mode, guarded by `mutex` except `watchdog_state` */
+	bool watchdog = false;
+	uint64_t watchdog_interval_ns = 0;
+	int64_t watchdog_tolerance_ns = 0;
+	std::atomic<int> watchdog_state{ST_WATCHDOG_OFF};
+	uint64_t watchdog_deadline = 0;
+	int64_t watchdog_baseline = 0;
+	int64_t watchdog_first = 0;
+	int64_t watchdog_sum = 0;
+	int watchdog_stable = 0;
+
+	/* Automatic stop, guarded by `mutex` except the atomics.
+	 * The capture is stopped from the next frame or packet after the estimates have converged. */
+	bool auto_stop = false;
+	double auto_stop_ci_ns = 0.0;
+	struct st_latency_estimator estimators[AUDIO_MAX_CARRIERS];
+	std::atomic<bool> auto_stop_requested{false};
+	std::atomic<bool> auto_stop_signaled{false};
+
+	/* Statistics */
+	uint64_t stats_start_ns = 0;
+	struct st_stage_counter stage_counters[ST_STAGE_COUNT];
+	std::atomic<uint64_t> video_frames{0};
+	std::atomic<uint64_t> video_frames_skipped{0};
+	std::atomic<uint64_t> audio_packets{0};
+	std::atomic<uint64_t> audio_packets_skipped{0};
+	std::atomic<uint64_t> video_frames_repeated{0};
+	std::atomic<uint64_t> video_repeat_runs[ST_REPEAT_RUN_BUCKETS] = {};
+	std::atomic<uint64_t> qr_decodes{0};
+	std::atomic<uint64_t> qr_cache_hits{0};
 
 	~sync_test_output()
 	{
-		if (qr)
-			quirc_destroy(qr);
+		for (auto *qr : qr_levels) {
+			if (qr)
+				quirc_destroy(qr);
+		}
 	}
 };
 
 static void video_marker_found(struct sync_test_output *st, uint64_t timestamp, float score);
+static void audio_tuning_update(struct sync_test_output *st, const struct st_tuning &tuning);
+static void st_proc_get_stats(void *data, calldata_t *cd);
 
 static const char *st_get_name(void *)
 {
 	return "sync-test-output";
 }
 
-static void *st_create(obs_data_t *, obs_output_t *output)
+static void st_get_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "analysis_threads", 0);
+	obs_data_set_default_bool(settings, "skip_repeated_frames", true);
+	obs_data_set_default_int(settings, "audio_detector", ST_AUDIO_DETECTOR_ENERGY);
+	obs_data_set_default_bool(settings, "watchdog", false);
+	obs_data_set_default_int(settings, "watchdog_interval_ms", 10000);
+	obs_data_set_default_int(settings, "watchdog_tolerance_ms", 20);
+	obs_data_set_default_bool(settings, "auto_stop", false);
+	obs_data_set_default_double(settings, "auto_stop_ci_ms", 1.0);
+	obs_data_set_default_bool(settings, "clapper", false);
+	obs_data_set_default_int(settings, "clapper_roi_x", 0);
+	obs_data_set_default_int(settings, "clapper_roi_y", 0);
+	obs_data_set_default_int(settings, "clapper_roi_w", 100);
+	obs_data_set_default_int(settings, "clapper_roi_h", 100);
+	obs_data_set_default_int(settings, "clapper_window_ms", 500);
+	obs_data_set_default_string(settings, "journal_path", "");
+	obs_data_set_default_int(settings, "journal_records", 262144);
+	obs_data_set_default_string(settings, "metrics_path", "");
+	obs_data_set_default_string(settings, "preset", st_presets[ST_PRESET_DEFAULT].name);
+}
+
+static obs_properties_t *st_get_properties(void *)
+{
+	obs_properties_t *props = obs_properties_create();
+	obs_property_t *prop;
+
+	prop = obs_properties_add_list(props, "preset", obs_module_text("Output.Prop.Preset"), OBS_COMBO_TYPE_LIST,
+				       OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(prop, obs_module_text("Preset.LowCpu"), "low_cpu");
+	obs_property_list_add_string(prop, obs_module_text("Preset.Balanced"), "balanced");
+	obs_property_list_add_string(prop, obs_module_text("Preset.HighPrecision"), "high_precision");
+
+	obs_properties_add_int(props, "qr_max_pixels", obs_module_text("Output.Prop.QrMaxPixels"), QR_MIN_AREA,
+			       7680 * 4320, 1);
+	obs_properties_add_bool(props, "qr_sparse", obs_module_text("Output.Prop.QrSparse"));
+	obs_properties_add_int(props, "audio_decimation", obs_module_text("Output.Prop.AudioDecimation"), 1,
+			       AUDIO_MAX_DECIMATION, 1);
+	obs_properties_add_int(props, "sync_list_size", obs_module_text("Output.Prop.SyncListSize"), 8, 1024, 1);
+
+	return props;
+}
+
+static struct st_tuning tuning_from_settings(obs_data_t *settings)
+{
+	const char *preset = obs_data_get_string(settings, "preset");
+	struct st_tuning t = st_presets[ST_PRESET_DEFAULT].tuning;
+	for (auto &p : st_presets) {
+		if (preset && strcmp(p.name, preset) == 0)
+			t = p.tuning;
+	}
+
+	if (obs_data_has_user_value(settings, "qr_max_pixels"))
+		t.qr_max_area = (uint64_t)std::max<long long>(obs_data_get_int(settings, "qr_max_pixels"), QR_MIN_AREA);
+	if (obs_data_has_user_value(settings, "qr_sparse"))
+		t.qr_sparse = obs_data_get_bool(settings, "qr_sparse");
+	if (obs_data_has_user_value(settings, "audio_decimation"))
+		t.audio_decimation = (uint32_t)std::clamp<long long>(obs_data_get_int(settings, "audio_decimation"), 1,
+								     AUDIO_MAX_DECIMATION);
+	if (obs_data_has_user_value(settings, "sync_list_size"))
+		t.sync_list_size = (uint32_t)std::max<long long>(obs_data_get_int(settings, "sync_list_size"), 1);
+
+	return t;
+}
+
+/* Also called while the output is active. The lock on the QR code and the pairs waiting in the sync list are kept. */
+static void st_update(void *data, obs_data_t *settings)
+{
+	auto *st = (struct sync_test_output *)data;
+	const struct st_tuning t = tuning_from_settings(settings);
+
+	std::unique_lock<std::mutex> lock(st->mutex);
+	st->tuning = t;
+	lock.unlock();
+	st->tuning_video_changed = true;
+	st->tuning_audio_changed = true;
+
+	blog(LOG_INFO, "%s: QR code up to %" PRIu64 " pixels%s, audio decimation %u, %u sync entries",
+	     obs_output_get_name(st->context), t.qr_max_area, t.qr_sparse ? " sparsely" : "", t.audio_decimation,
+	     t.sync_list_size);
+}
+
+static void *st_create(obs_data_t *settings, obs_output_t *output)
 {
 	static const char *signals[] = {
 		"void video_marker_found(ptr data)",
 		"void audio_marker_found(ptr data)",
 		"void qrcode_found(int timestamp, int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3)",
 		"void sync_found(ptr data)",
+		"void overlay_update(ptr data)",
+		"void watchdog_changed(int state, int baseline)",
+		"void cadence_updated(ptr data)",
+		"void audio_discontinuity(ptr data)",
+		"void glass_latency(ptr data)",
+		"void measurement_converged(ptr data)",
 		NULL,
 	};
 	signal_handler_add_array(obs_output_get_signal_handler(output), signals);
 
 	auto *st = new sync_test_output;
 	st->context = output;
+	st->analysis_threads = (int)obs_data_get_int(settings, "analysis_threads");
+	st->skip_repeated_frames = obs_data_get_bool(settings, "skip_repeated_frames");
+	st->audio_detector = (int)obs_data_get_int(settings, "audio_detector");
+	st->watchdog = obs_data_get_bool(settings, "watchdog");
+	st->watchdog_interval_ns = (uint64_t)obs_data_get_int(settings, "watchdog_interval_ms") * 1000000;
+	st->watchdog_tolerance_ns = (int64_t)obs_data_get_int(settings, "watchdog_tolerance_ms") * 1000000;
+	st->auto_stop = obs_data_get_bool(settings, "auto_stop");
+	st->auto_stop_ci_ns = obs_data_get_double(settings, "auto_stop_ci_ms") * 1e6;
+	st->clapper = obs_data_get_bool(settings, "clapper");
+	st->clapper_roi[0] = (int)obs_data_get_int(settings, "clapper_roi_x");
+	st->clapper_roi[1] = (int)obs_data_get_int(settings, "clapper_roi_y");
+	st->clapper_roi[2] = (int)obs_data_get_int(settings, "clapper_roi_w");
+	st->clapper_roi[3] = (int)obs_data_get_int(settings, "clapper_roi_h");
+	st->clapper_window_ns = (uint64_t)obs_data_get_int(settings, "clapper_window_ms") * 1000000;
+
+	const char *journal_path = obs_data_get_string(settings, "journal_path");
+	long long journal_records = obs_data_get_int(settings, "journal_records");
+	if (journal_path && *journal_path && journal_records > 0)
+		st->journal.open(journal_path, (size_t)journal_records);
+
+	const char *metrics_path = obs_data_get_string(settings, "metrics_path");
+	if (metrics_path && *metrics_path)
+		st->metrics.open(metrics_path, obs_output_get_name(output));
+
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+	proc_handler_add(ph, "void get_stats(in ptr data)", st_proc_get_stats, st);
+
+	st_update(st, settings);
 
 	return st;
 }
@@ -169,12 +547,121 @@ static void st_destroy(void *data)
 	delete st;
 }
 
+static void clapper_start(struct sync_test_output *st)
+{
+	auto to_px = [](int percent, uint32_t size) {
+		return (uint32_t)((uint64_t)std::clamp(percent, 0, 100) * size / 100);
+	};
+	st->clapper_x0 = to_px(st->clapper_roi[0], st->video_width);
+	st->clapper_y0 = to_px(st->clapper_roi[1], st->video_height);
+	st->clapper_x1 = std::min(st->video_width, st->clapper_x0 + to_px(st->clapper_roi[2], st->video_width));
+	st->clapper_y1 = std::min(st->video_height, st->clapper_y0 + to_px(st->clapper_roi[3], st->video_height));
+	if (st->clapper_x1 <= st->clapper_x0 || st->clapper_y1 <= st->clapper_y0) {
+		st->clapper_x0 = st->clapper_y0 = 0;
+		st->clapper_x1 = st->video_width;
+		st->clapper_y1 = st->video_height;
+	}
+
+	st->clapper_level_prev = -1.0f;
+	st->clapper_video_th.reset();
+	st->clapper_video_th.min_level = CLAPPER_MIN_STEP;
+	st->clapper_video_finder = peak_finder();
+	st->clapper_video_finder.dumping_range = CLAPPER_HOLD_NS;
+
+	/* A block of about 10 ms */
+	size_t n = 64;
+	while (n * 100 < st->audio_sample_rate)
+		n <<= 1;
+	st->clapper_flux.init(n);
+	st->clapper_flux_samples = 0;
+	st->clapper_audio_th.reset();
+	st->clapper_audio_th.min_level = CLAPPER_MIN_FLUX;
+	st->clapper_audio_finder = peak_finder();
+	st->clapper_audio_finder.dumping_range = CLAPPER_HOLD_NS;
+
+	st->clapper_video_last = st->clapper_audio_last = 0;
+	st->clapper_video_ts = st->clapper_audio_ts = 0;
+	st->clapper_count = 0;
+
+	blog(LOG_INFO, "%s: clapperboard mode, region %u,%u-%u,%u, audio block %zu samples",
+	     obs_output_get_name(st->context), st->clapper_x0, st->clapper_y0, st->clapper_x1, st->clapper_y1, n);
+}
+
 static uint8_t get_intensity_10le(const uint8_t *data)
 {
 	uint16_t v = (data[0] >> 2) | (data[1] << 6);
 	return (uint8_t)std::min<uint16_t>(v, 0xFF);
 }
 
+static uint8_t get_intensity_12le(const uint8_t *data)
+{
+	uint16_t v = (data[0] >> 4) | (data[1] << 4);
+	return (uint8_t)std::min<uint16_t>(v, 0xFF);
+}
+
+static struct st_tuning tuning_get(struct sync_test_output *st)
+{
+	std::unique_lock<std::mutex> lock(st->mutex);
+	return st->tuning;
+}
+
+/* Level `l` of the pyramid is used if its area is not larger than `qr_max_area`
+ * and the next finer level is larger than QR_MIN_AREA. */
+static bool qr_setup_levels(struct sync_test_output *st)
+{
+	auto level_area = [st](int l) { return (uint64_t)(st->video_width >> l) * (st->video_height >> l); };
+	st->qr_level_min = 0;
+	while (st->qr_level_min < QR_MAX_LEVELS - 1 && level_area(st->qr_level_min) > st->qr_max_area)
+		st->qr_level_min++;
+	st->qr_level_max = st->qr_level_min;
+	while (st->qr_level_max < QR_MAX_LEVELS - 1 && level_area(st->qr_level_max) > QR_MIN_AREA)
+		st->qr_level_max++;
+
+	for (int l = 0; l < QR_MAX_LEVELS; l++) {
+		if (l < st->qr_level_min || st->qr_level_max < l) {
+			if (st->qr_levels[l])
+				quirc_destroy(st->qr_levels[l]);
+			st->qr_levels[l] = nullptr;
+			continue;
+		}
+		if (!st->qr_levels[l])
+			st->qr_levels[l] = quirc_new();
+		if (!st->qr_levels[l]) {
+			blog(LOG_ERROR, "failed to create QR code encoding context");
+			return false;
+		}
+		if (quirc_resize(st->qr_levels[l], st->video_width >> l, st->video_height >> l) < 0) {
+			blog(LOG_ERROR, "failed to set-up QR code encoding context");
+			return false;
+		}
+	}
+	st->luma.init(st->video_width, st->video_height, st->qr_level_min);
+	return true;
+}
+
+/* Called from the video thread after `update`. The QR code stays locked if its level is still available. */
+static void video_tuning_update(struct sync_test_output *st)
+{
+	const struct st_tuning tuning = tuning_get(st);
+
+	st->qr_sparse = tuning.qr_sparse;
+	if (tuning.qr_max_area == st->qr_max_area)
+		return;
+
+	st->qr_max_area = tuning.qr_max_area;
+	if (!qr_setup_levels(st)) {
+		/* Frames are skipped as if the pixel format is not supported. */
+		st->video_pixelsize = 0;
+		return;
+	}
+	if (st->qr_level < st->qr_level_min || st->qr_level_max < st->qr_level) {
+		st->qr_level = st->qr_level_min;
+		st->qr_locked = false;
+	}
+	blog(LOG_INFO, "%s: decoding the QR code on levels %d to %d", obs_output_get_name(st->context),
+	     st->qr_level_min, st->qr_level_max);
+}
+
 static bool st_start(void *data)
 {
 	auto *st = (struct sync_test_output *)data;
@@ -192,11 +679,7 @@ static bool st_start(void *data)
 
 	st->video_width = video_output_get_width(video);
 	st->video_height = video_output_get_height(video);
-	if (st->video_width > MAX_WIDTH_HEIGHT || st->video_height > MAX_WIDTH_HEIGHT) {
-		blog(LOG_ERROR, "Requested size %ux%u exceeds maximum size %ux%u", st->video_width, st->video_height,
-		     MAX_WIDTH_HEIGHT, MAX_WIDTH_HEIGHT);
-		return false;
-	}
+	st->video_frame_rate = video_output_get_frame_rate(video);
 
 	enum video_format video_format = video_output_get_format(video);
 	switch (video_format) {
@@ -207,15 +690,39 @@ static bool st_start(void *data)
 	case VIDEO_FORMAT_I40A:
 	case VIDEO_FORMAT_I42A:
 	case VIDEO_FORMAT_YUVA:
+	case VIDEO_FORMAT_Y800:
 		st->video_pixelsize = 1;
 		st->video_pixeloffset = 0;
 		st->video_get_intensity = nullptr;
 		break;
+	case VIDEO_FORMAT_YUY2:
+	case VIDEO_FORMAT_YVYU:
+		st->video_pixelsize = 2;
+		st->video_pixeloffset = 0; // Y0 U Y1 V
+		st->video_get_intensity = nullptr;
+		break;
+	case VIDEO_FORMAT_UYVY:
+		st->video_pixelsize = 2;
+		st->video_pixeloffset = 1; // U Y0 V Y1
+		st->video_get_intensity = nullptr;
+		break;
+	case VIDEO_FORMAT_AYUV:
+		st->video_pixelsize = 4;
+		st->video_pixeloffset = 2; // V U Y A
+		st->video_get_intensity = nullptr;
+		break;
 	case VIDEO_FORMAT_I010:
+	case VIDEO_FORMAT_I210:
 		st->video_pixelsize = 2;
 		st->video_pixeloffset = 0;
 		st->video_get_intensity = get_intensity_10le;
 		break;
+	case VIDEO_FORMAT_I412:
+	case VIDEO_FORMAT_YA2L:
+		st->video_pixelsize = 2;
+		st->video_pixeloffset = 0;
+		st->video_get_intensity = get_intensity_12le;
+		break;
 	case VIDEO_FORMAT_P010:
 		st->video_pixelsize = 2;
 		st->video_pixeloffset = 1;
@@ -236,32 +743,82 @@ static bool st_start(void *data)
 		st->video_pixeloffset = 1; // green channel
 		st->video_get_intensity = nullptr;
 		break;
+	case VIDEO_FORMAT_BGR3:
+		st->video_pixelsize = 3;
+		st->video_pixeloffset = 1; // green channel
+		st->video_get_intensity = nullptr;
+		break;
 	default:
 		blog(LOG_ERROR, "unsupported pixel format %d", video_format);
 		return false;
 	}
 
-	uint32_t qr_width = st->video_width;
-	uint32_t qr_height = st->video_height;
-	st->qr_step = 1;
-	while (qr_width * qr_height > 640 * 480) {
-		qr_width /= 2;
-		qr_height /= 2;
-		st->qr_step *= 2;
-	}
-	if (!st->qr)
-		st->qr = quirc_new();
-	if (!st->qr) {
-		blog(LOG_ERROR, "failed to create QR code encoding context");
-		return false;
-	}
-	if (quirc_resize(st->qr, qr_width, qr_height) < 0) {
-		blog(LOG_ERROR, "failed to set-up QR code encoding context");
+	size_t n_threads = 1;
+	if (st->analysis_threads > 0)
+		n_threads = (size_t)st->analysis_threads;
+	else if (st->video_width * st->video_height >= AUTO_THREADS_MIN_PIXELS)
+		n_threads = (size_t)std::max(1, std::min(os_get_logical_cores() / 2, AUTO_THREADS_MAX));
+	/* Every output analyzes the frames on the shared pool, also with one band, to bound the CPU usage of all
+	 * sessions. */
+	if (!st->pool)
+		st->pool = st_worker_pool::shared();
+	n_threads = std::min(n_threads, st->pool->size() + 1);
+	st->n_threads = n_threads;
+	blog(LOG_INFO, "%s: analyzing %ux%u frames on %zu thread(s)", obs_output_get_name(st->context),
+	     st->video_width, st->video_height, n_threads);
+
+	st->tuning_video_changed = false;
+	st->tuning_audio_changed = false;
+	const struct st_tuning tuning = tuning_get(st);
+
+	st->qr_max_area = tuning.qr_max_area;
+	st->qr_sparse = tuning.qr_sparse;
+	if (!qr_setup_levels(st))
 		return false;
-	}
+	st->qr_level = st->qr_level_min;
+	st->qr_locked = false;
+	st->qr_next_decode_ts = 0;
 
 	st->audio_sample_rate = audio_output_get_sample_rate(audio);
 	st->audio_channels = audio_output_get_channels(audio);
+	st->audio_decimation = 0;
+	audio_tuning_update(st, tuning);
+
+	for (auto &c : st->stage_counters)
+		c.reset();
+	st->video_frames = st->video_frames_skipped = 0;
+	st->audio_packets = st->audio_packets_skipped = 0;
+	st->audio_discontinuities = st->audio_samples_dropped = st->audio_samples_inserted = 0;
+	st->audio_crc_errors = 0;
+	st->audio_ts_check.reset();
+	st->qr_decodes = st->qr_cache_hits = 0;
+	st->video_frames_repeated = 0;
+	for (auto &r : st->video_repeat_runs)
+		r = 0;
+	st->dup_valid = false;
+	st->dup_run = 0;
+	st->cadence.reset();
+	st->glass.reset();
+	st->qr_cache_valid = false;
+	st->stats_start_ns = os_gettime_ns();
+
+	st->metrics_video_ts = st->metrics_audio_ts = 0;
+	st->video_markers = st->video_markers_missed = 0;
+	st->video_last_index = -1;
+	st->audio_markers = st->audio_markers_missed = 0;
+	for (auto &car : st->carriers)
+		car.last_index = -1;
+
+	st->watchdog_stable = 0;
+	st->watchdog_state = st->watchdog && !st->clapper ? ST_WATCHDOG_LEARNING : ST_WATCHDOG_OFF;
+
+	for (auto &e : st->estimators)
+		e.reset();
+	st->auto_stop_requested = false;
+	st->auto_stop_signaled = false;
+
+	if (st->clapper)
+		clapper_start(st);
 
 	obs_output_begin_data_capture(st->context, OBS_OUTPUT_VIDEO | OBS_OUTPUT_AUDIO);
 
@@ -280,7 +837,7 @@ template<typename T> T sq(T x)
 	return x * x;
 }
 
-static inline uint32_t diff_u32(uint32_t x, uint32_t y)
+static inline uint64_t diff_u64(uint64_t x, uint64_t y)
 {
 	if (x < y)
 		return y - x;
@@ -288,14 +845,14 @@ static inline uint32_t diff_u32(uint32_t x, uint32_t y)
 		return x - y;
 }
 
-static inline uint32_t sqrt_u32(uint32_t x)
+static inline uint32_t sqrt_u64(uint64_t x)
 {
-	uint32_t r = 0;
-	for (uint32_t b = 1 << 15; b; b >>= 1) {
+	uint64_t r = 0;
+	for (uint64_t b = 1ULL << 31; b; b >>= 1) {
 		if (sq(r | b) <= x)
 			r |= b;
 	}
-	return r;
+	return (uint32_t)r;
 }
 
 static inline int qrcode_length(const struct corner_type *cc)
@@ -325,6 +882,16 @@ static inline void adjust_corners(struct corner_type *cc)
 	}
 }
 
+static void journal_qrcode_found(st_journal &journal, uint64_t timestamp, const struct corner_type *corners)
+{
+	st_journal_record r(ST_JOURNAL_QRCODE, 0, timestamp);
+	for (int i = 0; i < 4; i++) {
+		r.qrcode.x[i] = (int32_t)corners[i].x;
+		r.qrcode.y[i] = (int32_t)corners[i].y;
+	}
+	journal.write(r);
+}
+
 static void signal_qrcode_found(obs_output_t *ctx, uint64_t timestamp, const struct corner_type *corners)
 {
 	uint8_t stack[384];
@@ -344,37 +911,285 @@ static void signal_qrcode_found(obs_output_t *ctx, uint64_t timestamp, const str
 	signal_handler_signal(sh, "qrcode_found", &cd);
 }
 
-static void st_raw_video_qrcode_decode(struct sync_test_output *st, struct video_data *frame)
+struct intensity_direct
 {
-	int w, h;
-	auto qr = st->qr;
-	uint8_t *qrbuf = quirc_begin(qr, &w, &h);
+	inline uint8_t operator()(const uint8_t *data) const { return *data; }
+};
+
+struct intensity_func
+{
+	uint8_t (*func)(const uint8_t *data);
+	inline uint8_t operator()(const uint8_t *data) const { return func(data); }
+};
 
-	const auto qr_step = st->qr_step;
-	const auto pixelsize = st->video_pixelsize * qr_step;
-	const uint8_t *linedata = frame->data[0] + frame->linesize[0] * (qr_step / 2);
-	auto *ptr = qrbuf;
-	for (int y = 0; y < h; y++) {
-		const uint8_t *data = linedata + st->video_pixeloffset + st->video_pixelsize * (qr_step / 2);
-		if (!st->video_get_intensity) {
-			for (int x = 0; x < w; x++) {
-				*ptr++ = *data;
-				data += pixelsize;
+/* Fill a level of the luma pyramid from the frame by averaging `n_sub` x `n_sub` samples for each pixel.
+ * The sum of the samples are accumulated on `acc` for each tile. */
+template<typename get_t>
+static void qr_fill_rows(const struct sync_test_output *st, const struct video_data *frame, uint8_t *dst, int w,
+			 int y_begin, int y_end, get_t get_intensity)
+{
+	const uint32_t qr_step = st->qr_step.load(std::memory_order_relaxed);
+	const uint32_t n_sub = std::min<uint32_t>(qr_step, QR_MAX_SUBSAMPLES);
+	const uint32_t sub_step = qr_step / n_sub;
+	const uint32_t pixelsize = st->video_pixelsize;
+	const uint32_t sub_pixelsize = pixelsize * sub_step;
+	const uint32_t pixelsize_step = pixelsize * qr_step;
+	const uint32_t shift = n_sub == 4 ? 4 : n_sub == 2 ? 2 : 0;
+	uint16_t acc[QR_TILE_WIDTH];
+
+	for (int y = y_begin; y < y_end; y++) {
+		uint8_t *ptr = dst + (size_t)w * y;
+		for (int x0 = 0; x0 < w; x0 += QR_TILE_WIDTH) {
+			const int tw = std::min(w - x0, QR_TILE_WIDTH);
+			memset(acc, 0, sizeof(acc[0]) * tw);
+
+			for (uint32_t sy = 0; sy < n_sub; sy++) {
+				const uint32_t src_y = y * qr_step + sy * sub_step + sub_step / 2;
+				const uint8_t *data = frame->data[0] + (size_t)frame->linesize[0] * src_y +
+						      st->video_pixeloffset +
+						      (size_t)pixelsize * (x0 * qr_step + sub_step / 2);
+				for (int x = 0; x < tw; x++) {
+					const uint8_t *d = data;
+					uint16_t v = 0;
+					for (uint32_t sx = 0; sx < n_sub; sx++) {
+						v += get_intensity(d);
+						d += sub_pixelsize;
+					}
+					acc[x] += v;
+					data += pixelsize_step;
+				}
 			}
+
+			for (int x = 0; x < tw; x++)
+				ptr[x0 + x] = (uint8_t)(acc[x] >> shift);
 		}
-		else {
-			for (int x = 0; x < w; x++) {
-				*ptr++ = st->video_get_intensity(data);
-				data += pixelsize;
-			}
+	}
+}
+
+/* Returns the number of bands to split `lines` lines. */
+static inline size_t st_n_bands(const struct sync_test_output *st, uint32_t lines)
+{
+	size_t n = std::min<size_t>(st->n_threads, lines / MIN_BAND_LINES);
+	return std::max<size_t>(n, 1);
+}
+
+/* Call `func(i, begin, end)` for each band of [0, lines) on the worker pool. */
+template<typename func_t> static void st_run_bands(struct sync_test_output *st, uint32_t lines, func_t func)
+{
+	const size_t n = st_n_bands(st, lines);
+	st->pool->run(n, [&](size_t i) {
+		uint32_t begin = (uint32_t)(lines * i / n);
+		uint32_t end = (uint32_t)(lines * (i + 1) / n);
+		func(i, begin, end);
+	});
+}
+
+/* Fill level `l` of the luma pyramid from the frame unless it has been filled for this frame.
+ * This is the only pass over the frame for the QR code and the marker. */
+static void luma_pyramid_fill(struct sync_test_output *st, const struct video_data *frame, int l)
+{
+	auto &pyr = st->luma;
+	if (pyr.has(l))
+		return;
+
+	st->qr_step = 1u << l;
+	uint8_t *dst = pyr.row(l, 0);
+	const int w = (int)pyr.width[l];
+	st_run_bands(st, pyr.height[l], [&](size_t, uint32_t begin, uint32_t end) {
+		if (!st->video_get_intensity)
+			qr_fill_rows(st, frame, dst, w, begin, end, intensity_direct());
+		else
+			qr_fill_rows(st, frame, dst, w, begin, end, intensity_func{st->video_get_intensity});
+	});
+	pyr.base = pyr.top = l;
+}
+
+/* Reduce the luma pyramid of this frame up to level `l`.
+ * Returns false if no level at `l` or finer has been filled from this frame. */
+static bool luma_pyramid_reduce(struct sync_test_output *st, int l)
+{
+	auto &pyr = st->luma;
+	if (pyr.top < pyr.base || l < pyr.base)
+		return false;
+
+	for (int k = pyr.top + 1; k <= l; k++) {
+		st_run_bands(st, pyr.height[k],
+			     [&](size_t, uint32_t begin, uint32_t end) { pyr.reduce_rows(k, begin, end); });
+		pyr.top = k;
+	}
+	return true;
+}
+
+static inline struct st_luma_plane frame_luma_plane(const struct sync_test_output *st, const struct video_data *frame)
+{
+	struct st_luma_plane p;
+	p.data = frame->data[0] + st->video_pixeloffset;
+	p.linesize = frame->linesize[0];
+	p.pixelsize = st->video_pixelsize;
+	p.width = st->video_width;
+	p.height = st->video_height;
+	return p;
+}
+
+/* Choose the pyramid level to decode the QR code on this frame.
+ * While no QR code is locked, the levels are scanned from the coarsest one
+ * so that the cheapest level that can decode the code is found first. */
+static int qr_select_level(struct sync_test_output *st, uint64_t timestamp)
+{
+	if (st->qr_locked) {
+		uint64_t timeout = (uint64_t)st->qr_data.q_ms * 3 * 2 * 1000000;
+		if (timestamp - st->qr_last_found_ts <= timeout)
+			return st->qr_level;
+
+		blog(LOG_DEBUG, "QR code lost on level %d, scanning", st->qr_level);
+		st->qr_locked = false;
+		st->qr_level = st->qr_level_min;
+	}
+
+	int l = st->qr_level - 1;
+	if (l < st->qr_level_min)
+		l = st->qr_level_max;
+	return st->qr_level = l;
+}
+
+/* Lock the level so that the module pitch of the found code is not less
+ * than QR_MIN_MODULE_PIXELS on the level. */
+static void qr_lock_level(struct sync_test_output *st, const struct quirc_code *code, uint64_t timestamp)
+{
+	struct corner_type cc[N_CORNERS];
+	for (int j = 0; j < N_CORNERS; j++) {
+		cc[j].x = code->corners[j].x << st->qr_level;
+		cc[j].y = code->corners[j].y << st->qr_level;
+	}
+	float pitch = (float)qrcode_length(cc) / std::max(code->size, 1);
+
+	int l = st->qr_level_min;
+	while (l < st->qr_level_max && pitch >= QR_MIN_MODULE_PIXELS * (float)(2 << l))
+		l++;
+
+	if (!st->qr_locked || l != st->qr_level)
+		blog(LOG_DEBUG, "QR code module pitch %.1f px, decoding on level %d", pitch, l);
+	st->qr_level = l;
+	st->qr_locked = true;
+	st->qr_last_found_ts = timestamp;
+}
+
+static inline size_t qr_cells_bytes(const struct quirc_code *code)
+{
+	return ((size_t)code->size * code->size + 7) / 8;
+}
+
+static uint64_t qr_grid_hash(const struct quirc_code *code)
+{
+	/* FNV-1a */
+	uint64_t h = 0xCBF29CE484222325ULL ^ (uint64_t)code->size;
+	const size_t n = qr_cells_bytes(code);
+	for (size_t i = 0; i < n; i++) {
+		h ^= code->cell_bitmap[i];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+static bool qr_cache_lookup(struct sync_test_output *st, const struct quirc_code *code, uint64_t hash)
+{
+	if (!st->qr_cache_valid || st->qr_cache_hash != hash || st->qr_cache_size != code->size)
+		return false;
+	if (memcmp(st->qr_cache_cells, code->cell_bitmap, qr_cells_bytes(code)) != 0)
+		return false;
+
+	st->qr_data = st->qr_cache_data;
+	return true;
+}
+
+static void qr_cache_store(struct sync_test_output *st, const struct quirc_code *code, uint64_t hash)
+{
+	st->qr_cache_valid = true;
+	st->qr_cache_hash = hash;
+	st->qr_cache_size = code->size;
+	memcpy(st->qr_cache_cells, code->cell_bitmap, qr_cells_bytes(code));
+	st->qr_cache_data = st->qr_data;
+}
+
+/* Decode the grid into `st->qr_data`.
+ * If the grid is same as the last decoded one, the ECC decoding and the parsing are skipped. */
+static bool qr_decode_grid(struct sync_test_output *st, struct quirc_code *code)
+{
+	const uint64_t hash = qr_grid_hash(code);
+	if (qr_cache_lookup(st, code, hash)) {
+		st->qr_cache_hits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	st->qr_decodes.fetch_add(1, std::memory_order_relaxed);
+
+	/* Keep the grid before flipping so that the same grid hits the cache next time. */
+	struct quirc_code orig = *code;
+
+	struct quirc_data data;
+	auto err = quirc_decode(code, &data);
+	if (err == QUIRC_ERROR_DATA_ECC) {
+		quirc_flip(code);
+		err = quirc_decode(code, &data);
+	}
+
+	if (err)
+		return false;
+
+	if (data.payload_len < 0 || data.payload_len >= QUIRC_MAX_PAYLOAD)
+		return false;
+	data.payload[data.payload_len] = 0;
+	if (!st->qr_data.decode(data.payload, (size_t)data.payload_len))
+		return false;
+
+	qr_cache_store(st, &orig, hash);
+	return true;
+}
+
+/* Hands the pattern over to the audio thread.
+ * The pattern takes the slot of the same carrier or the least recently found one. */
+static void audio_pattern_found(struct sync_test_output *st, const st_qr_data &qr, uint64_t ts)
+{
+	std::unique_lock<std::mutex> lock(st->mutex);
+
+	struct st_audio_pattern *slot = &st->patterns[0];
+	for (auto &p : st->patterns) {
+		if (p.f == qr.f) {
+			slot = &p;
+			break;
 		}
+		if (p.last_ts < slot->last_ts)
+			slot = &p;
+	}
+
+	slot->f = qr.f;
+	slot->c = qr.c;
+	slot->q_ms = qr.q_ms;
+	slot->type_flags = qr.type_flags;
+	slot->last_ts = ts;
+}
+
+static void st_raw_video_qrcode_decode(struct sync_test_output *st, struct video_data *frame)
+{
+	int w, h;
+	const int level = qr_select_level(st, frame->timestamp);
+	auto qr = st->qr_levels[level];
+	uint8_t *qrbuf = quirc_begin(qr, &w, &h);
+
+	{
+		st_stage_scope scope(st->stage_counters[ST_STAGE_QR_FILL], ST_STAGE_QR_FILL);
 
-		linedata += frame->linesize[0] * qr_step;
+		/* The level is copied since quirc binarizes its buffer and the pyramid is used by the marker. */
+		luma_pyramid_fill(st, frame, level);
+		memcpy(qrbuf, st->luma.row(level, 0), (size_t)w * h);
 	}
 
-	quirc_end(qr);
+	st_stage_scope quirc_scope(st->stage_counters[ST_STAGE_QUIRC], ST_STAGE_QUIRC);
+
+	st->pool->run(1, [qr](size_t) { quirc_end(qr); });
 
 	int num_codes = quirc_count(qr);
+	st->overlay.n_codes = 0;
 
 	for (int i = 0; i < num_codes; i++) {
 		// (x0, y0): top left
@@ -383,91 +1198,157 @@ static void st_raw_video_qrcode_decode(struct sync_test_output *st, struct video
 		// (x3, y3): bottom left
 
 		struct quirc_code code;
-		struct quirc_data data;
 		quirc_extract(qr, i, &code);
-		auto err = quirc_decode(&code, &data);
-		if (err == QUIRC_ERROR_DATA_ECC) {
-			quirc_flip(&code);
-			err = quirc_decode(&code, &data);
-		}
+		bool decoded = qr_decode_grid(st, &code);
 
-		if (err)
-			continue;
+		if (st->overlay.n_codes < ST_OVERLAY_MAX_CODES) {
+			struct st_overlay_code &oc = st->overlay.codes[st->overlay.n_codes++];
+			for (int j = 0; j < ST_OVERLAY_CORNERS; j++) {
+				oc.x[j] = code.corners[j].x << level;
+				oc.y[j] = code.corners[j].y << level;
+			}
+			oc.decoded = decoded;
+		}
 
-		data.payload[QUIRC_MAX_PAYLOAD - 1] = 0;
-		if (!st->qr_data.decode((char *)data.payload))
+		if (!decoded)
 			continue;
 
 		for (int j = 0; j < 4; j++) {
-			st->qr_corners[j].x = code.corners[j].x * st->qr_step;
-			st->qr_corners[j].y = code.corners[j].y * st->qr_step;
+			st->qr_corners[j].x = code.corners[j].x << level;
+			st->qr_corners[j].y = code.corners[j].y << level;
 		}
 
+		qr_lock_level(st, &code, frame->timestamp);
+
 		signal_qrcode_found(st->context, frame->timestamp - st->start_ts, st->qr_corners);
+		journal_qrcode_found(st->journal, frame->timestamp - st->start_ts, st->qr_corners);
 
 		adjust_corners(st->qr_corners);
 
-		if (st->qr_data.f > 0 && st->qr_data.c > 0) {
-			std::unique_lock<std::mutex> lock(st->mutex);
-			st->f = st->qr_data.f;
-			st->c = st->qr_data.c;
-			st->q_ms = st->qr_data.q_ms;
-		}
+		if (st->qr_data.f > 0 && st->qr_data.c > 0)
+			audio_pattern_found(st, st->qr_data, frame->timestamp);
 
 		st->video_marker_max_ts = frame->timestamp + st->qr_data.q_ms * 3 * 1000000;
 		st->video_level_prev = 0;
+
+		/* The next QR code appears 3q after the first frame of this one, that is, 2q after this frame at the
+		 * earliest. Half a frame is left for the jitter of the timestamps. */
+		uint64_t half_frame = st->video_frame_rate > 0.0 ? (uint64_t)(0.5e9 / st->video_frame_rate) : 0;
+		st->qr_next_decode_ts = frame->timestamp + st->qr_data.q_ms * 2 * 1000000 - half_frame;
+	}
+}
+
+template<typename get_t>
+static uint64_t marker_sum_lines(const struct st_luma_plane &p, const struct corner_type &c, uint32_t y_begin,
+				 uint32_t y_end, uint32_t k, get_t get_intensity)
+{
+	const uint32_t pixelsize_k = p.pixelsize * k;
+	const uint64_t sq_r = sq<uint64_t>(c.r);
+	uint64_t sum = 0;
+
+	for (uint32_t y = y_begin; y < y_end; y += k) {
+		uint32_t dx = sqrt_u64(sq_r - sq(diff_u64(y, c.y)));
+		uint32_t x0 = c.x > dx ? c.x - dx : 0;
+		uint32_t x1 = std::min(c.x + dx, p.width);
+
+		const uint8_t *data = p.data + p.linesize * y + (size_t)p.pixelsize * x0;
+
+		for (uint32_t x = x0; x < x1; x += k) {
+			sum += get_intensity(data);
+			data += pixelsize_k;
+		}
 	}
+
+	return sum;
 }
 
 static void st_raw_video_find_marker(struct sync_test_output *st, struct video_data *frame)
 {
 	int64_t sum = 0;
 
+	st->overlay.marker_active = false;
+
 	if (frame->timestamp > st->video_marker_max_ts) {
 		st->video_level_prev = 0;
 		return;
 	}
 
-	const uint8_t *linedata = frame->data[0];
-	const uint32_t pixelsize = st->video_pixelsize;
+	if (st->qr_corners[0].r == 0)
+		return;
 
-	for (size_t i = 0; i < N_CORNERS; i++) {
-		const struct corner_type c = st->qr_corners[i];
-		if (c.r == 0)
-			return;
-		uint32_t y0 = c.y > c.r ? c.y - c.r : 0;
-		uint32_t y1 = std::min(c.y + c.r, st->video_height);
-		uint32_t sq_r = sq(c.r);
+	/* The circles are summed on the level of the pyramid where the radius is up to MARKER_MAX_RADIUS,
+	 * or on the level of the QR code if it is coarser but the radius is still MARKER_MIN_RADIUS.
+	 * The pyramid is filled from the level of the QR code, also on the frames the QR code is not decoded,
+	 * so that the sum does not change its estimator between the frames.
+	 * If the level is finer than the level of the QR code, every `k` lines and every `k` pixels of the
+	 * frame are sampled instead.
+	 * The 2x2 averages of the pyramid are rounded, so the sum is not exactly the sum of the frame. On a noisy
+	 * image the interpolated zero-cross moves by a few microseconds, far less than a frame. */
+	const uint32_t r = st->qr_corners[0].r;
+	int level = 0;
+	while (level < QR_MAX_LEVELS - 1 && (r >> level) > MARKER_MAX_RADIUS)
+		level++;
+	if (st->qr_level > level && (r >> st->qr_level) >= MARKER_MIN_RADIUS)
+		level = st->qr_level;
+	if (level < st->qr_level)
+		level = 0;
+
+	if (level > 0 && !st->luma.has(st->qr_level)) {
+		st_stage_scope scope(st->stage_counters[ST_STAGE_QR_FILL], ST_STAGE_QR_FILL);
+		luma_pyramid_fill(st, frame, st->qr_level);
+	}
 
-		for (uint32_t y = y0; y < y1; y++) {
-			uint32_t dx = sqrt_u32(sq_r - sq(diff_u32(y, c.y)));
-			uint32_t x0 = c.x > dx ? c.x - dx : 0;
-			uint32_t x1 = std::min(c.x + dx, st->video_width);
+	st_stage_scope scope(st->stage_counters[ST_STAGE_MARKER_SUM], ST_STAGE_MARKER_SUM);
 
-			const uint8_t *data =
-				linedata + frame->linesize[0] * y + st->video_pixeloffset + st->video_pixelsize * x0;
+	uint32_t k = 1;
+	struct st_luma_plane plane;
+	if (level > 0 && luma_pyramid_reduce(st, level)) {
+		plane = st->luma.plane(level);
+	}
+	else {
+		level = 0;
+		k = std::max<uint32_t>(1, r / MARKER_MAX_RADIUS);
+		plane = frame_luma_plane(st, frame);
+	}
+	const bool direct = level > 0 || !st->video_get_intensity;
+
+	/* Each circle is split into bands of sampled lines.
+	 * The partial sums are reduced in a fixed order after all bands are done. */
+	const uint32_t lines = (2 * (r >> level) + k - 1) / k;
+	const size_t n_bands = st_n_bands(st, lines);
+	auto &partial = st->marker_partial_sums;
+	partial.assign(N_CORNERS * n_bands, 0);
+
+	auto band_func = [&](size_t j) {
+		const size_t i = j / n_bands;
+		const size_t b = j % n_bands;
+		struct corner_type c;
+		c.x = st->qr_corners[i].x >> level;
+		c.y = st->qr_corners[i].y >> level;
+		c.r = st->qr_corners[i].r >> level;
+		uint32_t y0 = c.y > c.r ? c.y - c.r : 0;
+		uint32_t y1 = std::min(c.y + c.r, plane.height);
+		uint32_t n_lines = (y1 - y0 + k - 1) / k;
+		uint32_t begin = y0 + (uint32_t)(n_lines * b / n_bands) * k;
+		uint32_t end = std::min(y1, y0 + (uint32_t)(n_lines * (b + 1) / n_bands) * k);
+
+		uint64_t band_sum;
+		if (direct)
+			band_sum = marker_sum_lines(plane, c, begin, end, k, intensity_direct());
+		else
+			band_sum = marker_sum_lines(plane, c, begin, end, k, intensity_func{st->video_get_intensity});
+		partial[j] = (i & 1) ? (int64_t)band_sum : -(int64_t)band_sum;
+	};
 
-			uint32_t line_sum = 0;
+	st->pool->run(N_CORNERS * n_bands, band_func);
 
-			if (!st->video_get_intensity) {
-				for (uint32_t x = x0; x < x1; x++) {
-					line_sum += *data;
-					data += pixelsize;
-				}
-			}
-			else {
-				for (uint32_t x = x0; x < x1; x++) {
-					line_sum += st->video_get_intensity(data);
-					data += pixelsize;
-				}
-			}
+	for (int64_t p : partial)
+		sum += p;
+	sum *= sq<int64_t>((int64_t)k << level);
 
-			if (i & 1)
-				sum += line_sum;
-			else
-				sum -= line_sum;
-		}
-	}
+	/* Each pair of the circles contributes up to 255 * pi * r^2. */
+	st->overlay.marker_active = true;
+	st->overlay.level = (float)((double)sum / (2.0 * 255.0 * M_PI * sq<double>(st->qr_corners[0].r)));
 
 	// blog(LOG_INFO, "st_raw_video-plot: %.03f %f", (frame->timestamp - st->start_ts) * 1e-9, (double)sum / (255.0 * M_PI * sq(st->qr_corners[0].r)));
 
@@ -481,32 +1362,306 @@ static void st_raw_video_find_marker(struct sync_test_output *st, struct video_d
 	st->video_level_prev_ts = frame->timestamp;
 }
 
-static bool is_overlapped(uint32_t index, uint32_t index_max, uint32_t next_index)
+static void signal_overlay_update(struct sync_test_output *st, uint64_t timestamp)
 {
-	return index_max && ((index_max + next_index - index) % index_max) > index_max / 2;
-}
+	struct st_overlay_data &ov = st->overlay;
+	ov.timestamp = timestamp - st->start_ts;
+	ov.has_marker = st->qr_corners[0].r > 0;
+	for (int i = 0; i < ST_OVERLAY_CORNERS; i++) {
+		ov.marker_x[i] = (int)st->qr_corners[i].x;
+		ov.marker_y[i] = (int)st->qr_corners[i].y;
+	}
+	ov.marker_r = (int)st->qr_corners[0].r;
 
-static void signal_sync_found(obs_output_t *ctx, const struct sync_index *si)
-{
 	uint8_t stack[64];
 	struct calldata cd;
 	calldata_init_fixed(&cd, stack, sizeof(stack));
-	auto *sh = obs_output_get_signal_handler(ctx);
+	auto *sh = obs_output_get_signal_handler(st->context);
 
-	calldata_set_ptr(&cd, "data", const_cast<sync_index *>(si));
-	signal_handler_signal(sh, "sync_found", &cd);
+	calldata_set_ptr(&cd, "data", &ov);
+	signal_handler_signal(sh, "overlay_update", &cd);
 }
 
-static void sync_index_found(struct sync_test_output *st, int index, uint64_t ts, bool is_video, uint32_t index_max)
+static bool is_overlapped(uint32_t index, uint32_t index_max, uint32_t next_index)
 {
-	std::unique_lock<std::mutex> lock(st->mutex);
+	return index_max && ((index_max + next_index - index) % index_max) > index_max / 2;
+}
 
-	for (auto it = st->sync_indices.begin(); it != st->sync_indices.end();) {
-		if ((it->video_ts && is_video) || (it->audio_ts && !is_video)) {
-			if (is_overlapped(it->index, it->index_max, index)) {
-				st->sync_indices.erase(it++);
-				continue;
-			}
+static int missed_markers(int index, int last_index, uint32_t index_max)
+{
+	if (index == last_index + 1 || last_index < 0 || index_max == 0)
+		return 0;
+	return (int)((index_max + index - last_index - 1) % index_max);
+}
+
+/* Called with `st->mutex` locked. */
+static void metrics_sync_found(struct sync_test_output *st, const struct sync_index *si)
+{
+	st->metrics.update(&st_metrics_layout::sync, [si](st_metrics_sync &m) {
+		m.count++;
+		m.latency_ns = (int64_t)si->audio_ts - (int64_t)si->video_ts;
+		m.video_ts = si->video_ts;
+		m.audio_ts = si->audio_ts;
+		m.index = (uint32_t)si->index;
+		m.index_max = si->index_max;
+	});
+}
+
+/* Called from the video thread. */
+static void metrics_video_update(struct sync_test_output *st, uint64_t ts)
+{
+	if (!st->metrics.is_open() || ts < st->metrics_video_ts + METRICS_INTERVAL_NS)
+		return;
+	st->metrics_video_ts = ts;
+
+	st->metrics.update(&st_metrics_layout::video, [st](st_metrics_video &m) {
+		m.frames = st->video_frames.load(std::memory_order_relaxed);
+		m.frames_skipped = st->video_frames_skipped.load(std::memory_order_relaxed);
+		m.frames_repeated = st->video_frames_repeated.load(std::memory_order_relaxed);
+		m.qr_decodes = st->qr_decodes.load(std::memory_order_relaxed);
+		m.qr_cache_hits = st->qr_cache_hits.load(std::memory_order_relaxed);
+		m.markers = st->video_markers;
+		m.markers_missed = st->video_markers_missed;
+		m.qr_step = st->qr_step.load(std::memory_order_relaxed);
+		m.watchdog_state = (uint32_t)st->watchdog_state.load(std::memory_order_relaxed);
+		for (int i = 0; i < ST_STAGE_COUNT; i++) {
+			const auto &c = st->stage_counters[i];
+			m.stages[i].count = c.count.load(std::memory_order_relaxed);
+			m.stages[i].total_ns = c.total_ns.load(std::memory_order_relaxed);
+			m.stages[i].max_ns = c.max_ns.load(std::memory_order_relaxed);
+		}
+	});
+}
+
+/* Called from the audio thread. */
+static void metrics_audio_update(struct sync_test_output *st, uint64_t ts)
+{
+	if (!st->metrics.is_open() || ts < st->metrics_audio_ts + METRICS_INTERVAL_NS)
+		return;
+	st->metrics_audio_ts = ts;
+
+	st->metrics.update(&st_metrics_layout::audio, [st](st_metrics_audio &m) {
+		m.packets = st->audio_packets.load(std::memory_order_relaxed);
+		m.packets_skipped = st->audio_packets_skipped.load(std::memory_order_relaxed);
+		m.markers = st->audio_markers;
+		m.markers_missed = st->audio_markers_missed;
+		m.discontinuities = st->audio_discontinuities.load(std::memory_order_relaxed);
+		m.samples_dropped = st->audio_samples_dropped.load(std::memory_order_relaxed);
+		m.samples_inserted = st->audio_samples_inserted.load(std::memory_order_relaxed);
+		m.crc_errors = st->audio_crc_errors.load(std::memory_order_relaxed);
+	});
+}
+
+static void signal_sync_found(obs_output_t *ctx, const struct sync_index *si)
+{
+	uint8_t stack[64];
+	struct calldata cd;
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	auto *sh = obs_output_get_signal_handler(ctx);
+
+	calldata_set_ptr(&cd, "data", const_cast<sync_index *>(si));
+	signal_handler_signal(sh, "sync_found", &cd);
+}
+
+static const char *watchdog_state_name(int state)
+{
+	switch (state) {
+	case ST_WATCHDOG_OFF:
+		return "off";
+	case ST_WATCHDOG_LEARNING:
+		return "learning";
+	case ST_WATCHDOG_SLEEPING:
+		return "sleeping";
+	case ST_WATCHDOG_SAMPLING:
+		return "sampling";
+	case ST_WATCHDOG_ALERT:
+		return "alert";
+	}
+	return "unknown";
+}
+
+/* Called with `st->mutex` locked. */
+static void watchdog_set_state(struct sync_test_output *st, enum st_watchdog_state state)
+{
+	int prev = st->watchdog_state.exchange(state);
+	if (prev == state)
+		return;
+
+	if (state != ST_WATCHDOG_SLEEPING && state != ST_WATCHDOG_SAMPLING)
+		blog(LOG_INFO, "%s: watchdog %s -> %s", obs_output_get_name(st->context), watchdog_state_name(prev),
+		     watchdog_state_name(state));
+
+	uint8_t stack[128];
+	struct calldata cd;
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	auto *sh = obs_output_get_signal_handler(st->context);
+
+	calldata_set_int(&cd, "state", state);
+	calldata_set_int(&cd, "baseline", st->watchdog_baseline);
+	signal_handler_signal(sh, "watchdog_changed", &cd);
+}
+
+/* Called with `st->mutex` locked when the latency `latency` is measured at `ts`. */
+static void watchdog_sync_found(struct sync_test_output *st, int64_t latency, uint64_t ts)
+{
+	switch (st->watchdog_state.load()) {
+	case ST_WATCHDOG_LEARNING:
+	case ST_WATCHDOG_ALERT:
+		if (st->watchdog_stable > 0 && llabs(latency - st->watchdog_first) <= st->watchdog_tolerance_ns) {
+			st->watchdog_stable++;
+			st->watchdog_sum += latency;
+		}
+		else {
+			st->watchdog_stable = 1;
+			st->watchdog_first = latency;
+			st->watchdog_sum = latency;
+		}
+		if (st->watchdog_stable < WATCHDOG_STABLE_SYNCS)
+			return;
+		st->watchdog_baseline = st->watchdog_sum / st->watchdog_stable;
+		break;
+
+	case ST_WATCHDOG_SAMPLING:
+		if (llabs(latency - st->watchdog_baseline) > st->watchdog_tolerance_ns) {
+			blog(LOG_WARNING, "%s: watchdog: latency %.1f ms deviates from %.1f ms",
+			     obs_output_get_name(st->context), latency * 1e-6, st->watchdog_baseline * 1e-6);
+			st->watchdog_stable = 1;
+			st->watchdog_first = latency;
+			st->watchdog_sum = latency;
+			watchdog_set_state(st, ST_WATCHDOG_ALERT);
+			return;
+		}
+		break;
+
+	default:
+		return;
+	}
+
+	/* Pending indices would be paired with the indices found after sleeping. */
+	st->sync_indices.clear();
+	st->watchdog_deadline = ts + st->watchdog_interval_ns;
+	watchdog_set_state(st, ST_WATCHDOG_SLEEPING);
+}
+
+/* Called with `st->mutex` locked when the latency of the pattern of the carrier `f` is measured.
+ * Every carrier seen so far has to converge before stopping, except the carriers seen far less often. */
+static void convergence_sync_found(struct sync_test_output *st, int64_t latency, uint32_t f, uint64_t ts)
+{
+	if (!st->auto_stop || st->auto_stop_requested.load(std::memory_order_relaxed))
+		return;
+
+	struct st_latency_estimator *e = nullptr;
+	for (auto &x : st->estimators) {
+		if (x.count && x.f == f) {
+			e = &x;
+			break;
+		}
+		if (!x.count && !e)
+			e = &x;
+	}
+	if (!e)
+		return;
+	if (!e->count)
+		e->f = f;
+	e->add(latency);
+
+	uint64_t max_count = 0;
+	for (auto &x : st->estimators)
+		max_count = std::max(max_count, x.count);
+
+	for (auto &x : st->estimators) {
+		if (x.count && !x.minor(max_count) && !x.converged(st->auto_stop_ci_ns))
+			return;
+	}
+
+	auto *sh = obs_output_get_signal_handler(st->context);
+	for (auto &x : st->estimators) {
+		if (!x.count || x.minor(max_count))
+			continue;
+
+		struct st_convergence_s summary = x.summary();
+		blog(LOG_INFO, "%s: converged: f=%u latency %.2f ms, stddev %.2f ms, width %.2f ms, %" PRIu64 " pairs",
+		     obs_output_get_name(st->context), summary.f, summary.mean_ns * 1e-6, summary.stddev_ns * 1e-6,
+		     summary.ci_ns * 1e-6, summary.count);
+
+		uint8_t stack[64];
+		struct calldata cd;
+		calldata_init_fixed(&cd, stack, sizeof(stack));
+		calldata_set_ptr(&cd, "data", &summary);
+		signal_handler_signal(sh, "measurement_converged", &cd);
+
+		st_journal_record r(ST_JOURNAL_CONVERGED, (uint32_t)summary.count, ts);
+		r.converged.mean_ns = llround(summary.mean_ns);
+		r.converged.stddev_ns = llround(summary.stddev_ns);
+		r.converged.ci_ns = llround(summary.ci_ns);
+		r.converged.f = summary.f;
+		st->journal.write(r);
+	}
+
+	st->auto_stop_requested = true;
+}
+
+/* Returns true if the capture is being stopped after the measurement converged.
+ * The stop is signaled outside the detection so that no lock is held. */
+static bool auto_stop_frame(struct sync_test_output *st)
+{
+	if (!st->auto_stop_requested.load(std::memory_order_relaxed))
+		return false;
+
+	if (!st->auto_stop_signaled.exchange(true))
+		obs_output_signal_stop(st->context, OBS_OUTPUT_SUCCESS);
+	return true;
+}
+
+/* Returns false if the video frame at `ts` does not need to be analyzed. */
+static bool watchdog_video_frame(struct sync_test_output *st, uint64_t ts)
+{
+	int state = st->watchdog_state.load(std::memory_order_relaxed);
+	if (state != ST_WATCHDOG_SLEEPING && state != ST_WATCHDOG_SAMPLING)
+		return true;
+
+	std::unique_lock<std::mutex> lock(st->mutex);
+	state = st->watchdog_state.load();
+
+	if (state == ST_WATCHDOG_SLEEPING) {
+		if (ts < st->watchdog_deadline)
+			return false;
+
+		/* A cycle of the pattern is 3 * q. Waiting for the next QR code, the
+		 * marker and the audio takes up to 2 cycles and the latency. */
+		uint64_t window = (uint64_t)st->qr_data.q_ms * 7 * 1000000 + (uint64_t)llabs(st->watchdog_baseline);
+		st->watchdog_deadline = ts + window;
+		st->qr_last_found_ts = ts; // Keep the decode level found before sleeping.
+		watchdog_set_state(st, ST_WATCHDOG_SAMPLING);
+		return true;
+	}
+
+	if (ts >= st->watchdog_deadline) {
+		blog(LOG_WARNING, "%s: watchdog: no sync pattern found while sampling", obs_output_get_name(st->context));
+		st->watchdog_stable = 0;
+		watchdog_set_state(st, ST_WATCHDOG_ALERT);
+	}
+	return true;
+}
+
+static void sync_index_found(struct sync_test_output *st, int index, uint64_t ts, bool is_video, uint32_t index_max,
+			     uint32_t f)
+{
+	std::unique_lock<std::mutex> lock(st->mutex);
+	st_stage_scope scope(st->stage_counters[ST_STAGE_MATCHING], ST_STAGE_MATCHING);
+
+	for (auto it = st->sync_indices.begin(); it != st->sync_indices.end();) {
+		/* Patterns of other carriers are paired independently. */
+		if (it->f != f) {
+			it++;
+			continue;
+		}
+
+		if ((it->video_ts && is_video) || (it->audio_ts && !is_video)) {
+			if (is_overlapped(it->index, it->index_max, index)) {
+				st->sync_indices.erase(it++);
+				continue;
+			}
 		}
 
 		if (it->index != index) {
@@ -520,6 +1675,19 @@ static void sync_index_found(struct sync_test_output *st, int index, uint64_t ts
 				it->index_max = index_max;
 
 			signal_sync_found(st->context, &*it);
+			metrics_sync_found(st, &*it);
+
+			st_journal_record r(ST_JOURNAL_SYNC, (uint32_t)it->index, ts);
+			r.sync.video_ts = it->video_ts;
+			r.sync.audio_ts = it->audio_ts;
+			r.sync.index_max = it->index_max;
+			r.sync.f = it->f;
+			st->journal.write(r);
+
+			/* The watchdog might clear `sync_indices`. */
+			const int64_t latency = (int64_t)it->audio_ts - (int64_t)it->video_ts;
+			convergence_sync_found(st, latency, f, ts);
+			watchdog_sync_found(st, latency, st->start_ts + ts);
 
 			/* Do not erase `it` so that `identify_audio_index_max` can refer the last found pattern.
 			 * Current `it` will be erased at the next call of this function. */
@@ -531,13 +1699,33 @@ static void sync_index_found(struct sync_test_output *st, int index, uint64_t ts
 		break;
 	}
 
-	while (st->sync_indices.size() >= 128)
+	while (st->sync_indices.size() >= st->tuning.sync_list_size)
 		st->sync_indices.erase(st->sync_indices.begin());
 
 	auto &ref = st->sync_indices.emplace_back();
 	ref.index = index;
 	(is_video ? ref.video_ts : ref.audio_ts) = ts;
 	ref.index_max = index_max;
+	ref.f = f;
+}
+
+/* Called from the video thread when the marker of the pattern with the timecode is found. */
+static void glass_latency_found(struct sync_test_output *st, uint64_t timestamp, uint64_t timecode_us)
+{
+	const uint64_t timecode_ns = timecode_us * 1000;
+	const int64_t latency_ns = (int64_t)timestamp - (int64_t)timecode_ns;
+	st->glass.add(latency_ns);
+
+	uint8_t stack[64];
+	struct calldata cd;
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_ptr(&cd, "data", &st->glass.stats);
+	signal_handler_signal(obs_output_get_signal_handler(st->context), "glass_latency", &cd);
+
+	st_journal_record r(ST_JOURNAL_GLASS_LATENCY, st->qr_data.index, timestamp - st->start_ts);
+	r.glass.timecode_ns = timecode_ns;
+	r.glass.latency_ns = latency_ns;
+	st->journal.write(r);
 }
 
 static void video_marker_found(struct sync_test_output *st, uint64_t timestamp, float score)
@@ -555,24 +1743,253 @@ static void video_marker_found(struct sync_test_output *st, uint64_t timestamp,
 	calldata_set_ptr(&cd, "data", &data);
 	signal_handler_signal(sh, "video_marker_found", &cd);
 
-	sync_index_found(st, data.qr_data.index, data.timestamp, true, data.qr_data.index_max);
+	st->video_markers++;
+	st->video_markers_missed += missed_markers((int)data.qr_data.index, st->video_last_index,
+						   st->video_last_index_max);
+	st->video_last_index = (int)data.qr_data.index;
+	st->video_last_index_max = data.qr_data.index_max;
+
+	st_journal_record r(ST_JOURNAL_VIDEO_MARKER, data.qr_data.index, data.timestamp);
+	r.video.score = score;
+	r.video.index_max = data.qr_data.index_max;
+	r.video.f = data.qr_data.f;
+	r.video.c = data.qr_data.c;
+	r.video.q_ms = data.qr_data.q_ms;
+	st->journal.write(r);
+
+	sync_index_found(st, data.qr_data.index, data.timestamp, true, data.qr_data.index_max, data.qr_data.f);
+
+	if (data.qr_data.timecode_us)
+		glass_latency_found(st, timestamp, data.qr_data.timecode_us);
+}
+
+/* Pair the event with the event of the other type within `clapper_window_ns`. */
+static void clapper_event_found(struct sync_test_output *st, uint64_t ts, bool is_video, float score)
+{
+	uint64_t &last = is_video ? st->clapper_video_last : st->clapper_audio_last;
+	if (last && ts < last + CLAPPER_HOLD_NS)
+		return;
+	last = ts;
+	(is_video ? st->video_markers : st->audio_markers)++;
+
+	st_journal_record r(is_video ? ST_JOURNAL_VIDEO_MARKER : ST_JOURNAL_AUDIO_MARKER, 0, ts);
+	(is_video ? r.video.score : r.audio.score) = score;
+	st->journal.write(r);
+
+	std::unique_lock<std::mutex> lock(st->mutex);
+	uint64_t &other = is_video ? st->clapper_audio_ts : st->clapper_video_ts;
+	if (!other || diff_u64(ts, other) > st->clapper_window_ns) {
+		(is_video ? st->clapper_video_ts : st->clapper_audio_ts) = ts;
+		return;
+	}
+
+	struct sync_index si;
+	si.index = st->clapper_count++;
+	si.video_ts = is_video ? ts : other;
+	si.audio_ts = is_video ? other : ts;
+	si.index_max = 0;
+	other = 0;
+
+	signal_sync_found(st->context, &si);
+	metrics_sync_found(st, &si);
+
+	st_journal_record rs(ST_JOURNAL_SYNC, (uint32_t)si.index, ts);
+	rs.sync.video_ts = si.video_ts;
+	rs.sync.audio_ts = si.audio_ts;
+	st->journal.write(rs);
+
+	convergence_sync_found(st, (int64_t)si.audio_ts - (int64_t)si.video_ts, 0, ts);
+}
+
+template<typename get_t>
+static uint64_t clapper_roi_sum(const struct sync_test_output *st, const struct video_data *frame, uint32_t k,
+				uint64_t *n, get_t get_intensity)
+{
+	uint64_t sum = 0;
+	for (uint32_t y = st->clapper_y0 + k / 2; y < st->clapper_y1; y += k) {
+		const uint8_t *data = frame->data[0] + (size_t)frame->linesize[0] * y + st->video_pixeloffset +
+				      (size_t)st->video_pixelsize * (st->clapper_x0 + k / 2);
+		for (uint32_t x = st->clapper_x0 + k / 2; x < st->clapper_x1; x += k) {
+			sum += get_intensity(data);
+			data += st->video_pixelsize * k;
+			(*n)++;
+		}
+	}
+	return sum;
+}
+
+/* A flash or a closing slate changes the brightness of the region at once. */
+static void st_raw_video_clapper(struct sync_test_output *st, struct video_data *frame)
+{
+	st_stage_scope scope(st->stage_counters[ST_STAGE_MARKER_SUM], ST_STAGE_MARKER_SUM);
+
+	const uint32_t size = std::max(st->clapper_x1 - st->clapper_x0, st->clapper_y1 - st->clapper_y0);
+	const uint32_t k = std::max<uint32_t>(1, size / CLAPPER_ROI_SAMPLES);
+	uint64_t n = 0;
+	uint64_t sum;
+	if (!st->video_get_intensity)
+		sum = clapper_roi_sum(st, frame, k, &n, intensity_direct());
+	else
+		sum = clapper_roi_sum(st, frame, k, &n, intensity_func{st->video_get_intensity});
+	if (!n)
+		return;
+
+	float level = (float)sum / (float)n;
+	float prev = st->clapper_level_prev;
+	st->clapper_level_prev = level;
+	if (prev < 0.0f)
+		return;
+
+	float score = st->clapper_video_th.apply(fabsf(level - prev));
+	auto &finder = st->clapper_video_finder;
+	if (finder.append(score, frame->timestamp, 0))
+		clapper_event_found(st, finder.last_ts - st->start_ts, true, finder.last_score);
+}
+
+template<typename get_t>
+static uint64_t frame_checksum(const struct sync_test_output *st, const struct video_data *frame, get_t get_intensity)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	auto add_sample = [&](uint32_t x, uint32_t y) {
+		const uint8_t *data = frame->data[0] + (size_t)frame->linesize[0] * y + st->video_pixeloffset +
+				      (size_t)st->video_pixelsize * x;
+		h ^= get_intensity(data);
+		h *= 0x100000001B3ULL;
+	};
+
+	for (uint32_t j = 0; j < DUP_GRID_Y; j++) {
+		uint32_t y = (uint32_t)((uint64_t)st->video_height * (2 * j + 1) / (2 * DUP_GRID_Y));
+		for (uint32_t i = 0; i < DUP_GRID_X; i++)
+			add_sample((uint32_t)((uint64_t)st->video_width * (2 * i + 1) / (2 * DUP_GRID_X)), y);
+	}
+
+	/* The marker circles are covered by the bounding box of the circles. */
+	const struct corner_type *cc = st->qr_corners;
+	if (cc[0].r) {
+		uint32_t x0 = UINT32_MAX, y0 = UINT32_MAX, x1 = 0, y1 = 0;
+		for (int i = 0; i < N_CORNERS; i++) {
+			x0 = std::min(x0, cc[i].x > cc[i].r ? cc[i].x - cc[i].r : 0);
+			y0 = std::min(y0, cc[i].y > cc[i].r ? cc[i].y - cc[i].r : 0);
+			x1 = std::max(x1, std::min(cc[i].x + cc[i].r, st->video_width - 1));
+			y1 = std::max(y1, std::min(cc[i].y + cc[i].r, st->video_height - 1));
+		}
+		for (uint32_t j = 0; j < DUP_ROI_GRID; j++) {
+			uint32_t y = y0 + (y1 - y0) * (2 * j + 1) / (2 * DUP_ROI_GRID);
+			for (uint32_t i = 0; i < DUP_ROI_GRID; i++)
+				add_sample(x0 + (x1 - x0) * (2 * i + 1) / (2 * DUP_ROI_GRID), y);
+		}
+	}
+
+	return h;
+}
+
+/* Returns true if the frame has the same content as the previous frame.
+ * The length of each run of the identical frames is counted to tell the cadence of the source. */
+static bool st_raw_video_is_repeated(struct sync_test_output *st, const struct video_data *frame)
+{
+	uint64_t h;
+	if (!st->video_get_intensity)
+		h = frame_checksum(st, frame, intensity_direct());
+	else
+		h = frame_checksum(st, frame, intensity_func{st->video_get_intensity});
+
+	if (st->dup_valid && h == st->dup_hash) {
+		st->dup_run++;
+		st->video_frames_repeated.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	if (st->dup_run > 0) {
+		size_t b = std::min<size_t>(st->dup_run, ST_REPEAT_RUN_BUCKETS) - 1;
+		st->video_repeat_runs[b].fetch_add(1, std::memory_order_relaxed);
+	}
+	st->dup_valid = true;
+	st->dup_hash = h;
+	st->dup_run = 1;
+	return false;
+}
+
+/* Counts the frame of `state` and reports the cadence at the end of each cycle of the pattern. */
+static void cadence_frame(struct sync_test_output *st, int state)
+{
+	const uint32_t expected = (uint32_t)lround(st->qr_data.q_ms * 1e-3 * st->video_frame_rate);
+	if (!st->cadence.frame(state, expected))
+		return;
+
+	struct st_cadence_stats stats = st->cadence.stats;
+
+	uint8_t stack[64];
+	struct calldata cd;
+	calldata_init_fixed(&cd, stack, sizeof(stack));
+	calldata_set_ptr(&cd, "data", &stats);
+	signal_handler_signal(obs_output_get_signal_handler(st->context), "cadence_updated", &cd);
 }
 
 static void st_raw_video(void *data, struct video_data *frame)
 {
 	auto *st = (struct sync_test_output *)data;
 
-	if (!st->video_pixelsize)
+	st->video_frames.fetch_add(1, std::memory_order_relaxed);
+	metrics_video_update(st, frame->timestamp);
+
+	if (auto_stop_frame(st)) {
+		st->video_frames_skipped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	if (st->tuning_video_changed.exchange(false))
+		video_tuning_update(st);
+
+	if (!st->video_pixelsize) {
+		st->video_frames_skipped.fetch_add(1, std::memory_order_relaxed);
 		return;
+	}
 
 	if (!st->start_ts)
 		st->start_ts = frame->timestamp;
 
-	st_raw_video_qrcode_decode(st, frame);
+	st->cadence.timestamp(frame->timestamp, st->video_frame_rate > 0.0 ? 1e9 / st->video_frame_rate : 0.0);
+
+	if (!watchdog_video_frame(st, frame->timestamp)) {
+		st->video_frames_skipped.fetch_add(1, std::memory_order_relaxed);
+		st->video_level_prev = 0;
+		st->dup_valid = false;
+		cadence_frame(st, ST_CADENCE_NONE);
+		return;
+	}
+
+	/* A repeated frame is not a new sample of the pattern.
+	 * `video_level_prev_ts` keeps the timestamp when the content appeared first
+	 * so that the zero-cross is interpolated over the actual interval of the source.
+	 * The cadence still counts the frame as delivered in the same state.
+	 * Until the QR code is found, the checksum covers only the coarse grid, which might not see the difference of two
+	 * QR codes, so no frame is skipped. */
+	const bool roi_known = st->clapper || st->qr_corners[0].r;
+	if (!roi_known)
+		st->dup_valid = false;
+	if (st->skip_repeated_frames && roi_known && st_raw_video_is_repeated(st, frame)) {
+		st->video_frames_skipped.fetch_add(1, std::memory_order_relaxed);
+		if (frame->timestamp > st->video_marker_max_ts)
+			st->video_level_prev = 0;
+		cadence_frame(st, st->cadence.state);
+		return;
+	}
+
+	st->luma.invalidate();
+
+	if (st->clapper) {
+		st_raw_video_clapper(st, frame);
+		return;
+	}
+
+	if (!st->qr_sparse || !st->qr_locked || frame->timestamp >= st->qr_next_decode_ts)
+		st_raw_video_qrcode_decode(st, frame);
 	st_raw_video_find_marker(st, frame);
+	cadence_frame(st, st->overlay.marker_active ? st->cadence.classify(st->overlay.level) : ST_CADENCE_NONE);
+	signal_overlay_update(st, frame->timestamp);
 }
 
-static uint32_t identify_audio_index_max(struct sync_test_output *st, int index)
+static uint32_t identify_audio_index_max(struct sync_test_output *st, struct st_audio_carrier &car, int index)
 {
 	/* Find `index_max` for video marker that have the biggest index but
 	 * the index is less than or equal to the given index.
@@ -580,12 +1997,12 @@ static uint32_t identify_audio_index_max(struct sync_test_output *st, int index)
 	 */
 
 	std::unique_lock<std::mutex> lock(st->mutex);
-	uint32_t last_index_max = 256;
-	uint32_t cand = st->last_audio_index_max;
-	uint32_t cand_diff = 256;
+	uint32_t last_index_max = car.last_index_max;
+	uint32_t cand = car.last_index_max;
+	uint32_t cand_diff = UINT32_MAX;
 
 	for (auto it = st->sync_indices.begin(); it != st->sync_indices.end(); it++) {
-		if (!it->video_ts || !it->index_max)
+		if (!it->video_ts || !it->index_max || it->f != car.f)
 			continue;
 		uint32_t diff = (last_index_max + index - it->index) % last_index_max;
 		if (diff < cand_diff) {
@@ -595,14 +2012,15 @@ static uint32_t identify_audio_index_max(struct sync_test_output *st, int index)
 		last_index_max = it->index_max;
 	}
 
-	return st->last_audio_index_max = cand;
+	return cand;
 }
 
-static uint32_t crc4_check(uint32_t data, uint32_t size)
+/* Returns the remainder of `data` of `size` bits divided by `poly` of `width + 1` bits. */
+static uint32_t crc_check(uint32_t data, uint32_t size, uint32_t poly, uint32_t width)
 {
-	uint32_t p = 0x13 << (size - 5);
-	while (size > 4) {
-		if (data & (1 << (size - 1)))
+	uint32_t p = poly << (size - width - 1);
+	while (size > width) {
+		if (data & (1u << (size - 1)))
 			data ^= p;
 		size--;
 		p >>= 1;
@@ -610,31 +2028,79 @@ static uint32_t crc4_check(uint32_t data, uint32_t size)
 	return data;
 }
 
-static inline void st_raw_audio_decode_data(struct sync_test_output *st, std::complex<float> phase, uint64_t ts)
+static inline uint32_t n_data_symbols(uint32_t type_flags)
 {
-	uint32_t symbol_num = st->audio_sample_rate * st->c_last;
-	uint32_t symbol_den = st->f_last;
+	return type_flags & ST_QR_TYPE_V2 ? N_DATA_SYMBOLS_V2 : N_DATA_SYMBOLS_V1;
+}
+
+/* Called from the audio thread. `ts` is the timestamp of the audio where the discontinuity is found. */
+static void audio_discontinuity_found(struct sync_test_output *st, uint64_t ts, enum st_audio_discontinuity_type type,
+				      int64_t samples, uint32_t f)
+{
+	if (type == ST_AUDIO_DISCONTINUITY_TIMESTAMP)
+		st->audio_discontinuities.fetch_add(1, std::memory_order_relaxed);
+	else if (samples > 0)
+		st->audio_samples_inserted.fetch_add((uint64_t)samples, std::memory_order_relaxed);
+	else
+		st->audio_samples_dropped.fetch_add((uint64_t)-samples, std::memory_order_relaxed);
+
+	blog(LOG_WARNING, "%s: audio %s %+" PRId64 " samples at %.3f s", obs_output_get_name(st->context),
+	     type == ST_AUDIO_DISCONTINUITY_TIMESTAMP ? "timestamp jumped by" : "slipped by", samples,
+	     (ts - st->start_ts) * 1e-9);
+
+	uint8_t stack[64];
+	struct calldata cd;
+	calldata_init_fixed(&cd, stack, sizeof(stack));
 
-	uint16_t index = 0;
-	for (int i = 0; i < 12; i += 2) {
-		auto s0 = st->audio_buffer.sum(symbol_num * i / 2 / symbol_den);
-		auto s1 = st->audio_buffer.sum(symbol_num * (i / 2 + 1) / symbol_den);
+	struct audio_discontinuity_s data;
+	data.timestamp = ts - st->start_ts;
+	data.type = type;
+	data.samples = samples;
+	data.f = f;
+	calldata_set_ptr(&cd, "data", &data);
+	signal_handler_signal(obs_output_get_signal_handler(st->context), "audio_discontinuity", &cd);
+
+	st_journal_record r(ST_JOURNAL_AUDIO_DISCONTINUITY, 0, data.timestamp);
+	r.discontinuity.samples = samples;
+	r.discontinuity.type = (uint32_t)type;
+	r.discontinuity.f = f;
+	st->journal.write(r);
+}
+
+/* Decode the data symbols that end `offset` samples before the last sample in the buffer. */
+static inline void st_raw_audio_decode_data(struct sync_test_output *st, struct st_audio_carrier &car,
+					    std::complex<float> phase, uint64_t ts, size_t offset)
+{
+	uint32_t symbol_num = st->audio_baseband_rate * car.c;
+	uint32_t symbol_den = car.f;
+	const bool v2 = car.type_flags & ST_QR_TYPE_V2;
+	const int n_bits = (int)n_data_symbols(car.type_flags) * 2;
+
+	uint32_t bits = 0;
+	for (int i = 0; i < n_bits; i += 2) {
+		auto s0 = car.buffer.sum(offset + symbol_num * i / 2 / symbol_den);
+		auto s1 = car.buffer.sum(offset + symbol_num * (i / 2 + 1) / symbol_den);
 		auto x = int16_to_complex(s0 - s1);
 		auto real = (x / phase).real();
 		auto imag = (x / phase).imag();
 		if (real > 0.0f)
-			index |= 1 << i;
+			bits |= 1 << i;
 		if (imag > 0.0f)
-			index |= 2 << i;
+			bits |= 2 << i;
 	}
 
-	auto crc4 = crc4_check(0xF0000 | index, 20);
+	/* The CRC covers the preamble 0xF0, too. */
+	uint32_t crc = v2 ? crc_check(0xF0000000 | bits, 32, 0x107, 8) : crc_check(0xF0000 | bits, 20, 0x13, 4);
 
-	if (crc4 != 0) {
-		blog(LOG_DEBUG, "st_raw_audio_decode_data: CRC mismatch: received data=0x%03X crc=0x%X", index, crc4);
+	if (crc != 0) {
+		blog(LOG_DEBUG, "st_raw_audio_decode_data: CRC mismatch: f=%u received data=0x%06X crc=0x%X", car.f,
+		     bits, crc);
+		st->audio_crc_errors.fetch_add(1, std::memory_order_relaxed);
 		return;
 	}
 
+	int index = (int)(bits >> (v2 ? 8 : 4));
+
 	uint8_t stack[64];
 	struct calldata cd;
 	calldata_init_fixed(&cd, stack, sizeof(stack));
@@ -642,48 +2108,338 @@ static inline void st_raw_audio_decode_data(struct sync_test_output *st, std::co
 
 	struct audio_marker_found_s data;
 	data.timestamp = ts - st->start_ts;
-	data.index = index >> 4;
+	data.index = index;
 	data.score = 0.0f;
-	data.index_max = identify_audio_index_max(st, index >> 4);
+	data.index_max = identify_audio_index_max(st, car, index);
+	data.f = car.f;
+
+	st->audio_markers++;
+	st->audio_markers_missed += missed_markers(index, car.last_index, car.last_index_max);
+	car.last_index = index;
+	car.last_index_max = data.index_max;
 
 	calldata_set_ptr(&cd, "data", &data);
 	signal_handler_signal(sh, "audio_marker_found", &cd);
 
-	sync_index_found(st, index >> 4, ts - st->start_ts, false, data.index_max);
+	st_journal_record r(ST_JOURNAL_AUDIO_MARKER, (uint32_t)data.index, data.timestamp);
+	r.audio.score = data.score;
+	r.audio.index_max = data.index_max;
+	r.audio.f = data.f;
+	st->journal.write(r);
+
+	sync_index_found(st, index, ts - st->start_ts, false, data.index_max, data.f);
+
+	int64_t slip = car.slip.marker(ts, std::arg(phase), index, data.index_max, car.f, st->audio_sample_rate);
+	if (slip)
+		audio_discontinuity_found(st, ts, ST_AUDIO_DISCONTINUITY_SLIP, slip, car.f);
 }
 
-static inline void st_raw_audio_test_preamble(struct sync_test_output *st, uint64_t ts, float v0)
+/* Called when the peak of the preamble is found.
+ * The data symbols end `offset` samples before the last sample in the buffer. */
+static void st_raw_audio_marker_found(struct sync_test_output *st, struct st_audio_carrier &car, size_t offset)
 {
-	uint32_t f = st->f_last;
-	uint32_t c1 = st->c_last / 2;
+	uint32_t f = car.f;
+	uint32_t c1 = car.c / 2;
 	uint64_t symbol_ns = util_mul_div64(c1, 1000000000ULL, f);
-	size_t buffer_length = (size_t)(st->audio_sample_rate * c1 * N_SYMBOL_BUFFER / f);
+	size_t buffer_length = (size_t)(st->audio_baseband_rate * c1 * N_SYMBOL_BUFFER / f);
+	const uint32_t k = n_data_symbols(car.type_flags) * 2;
+
+	/* The last 2 symbols of the preamble follow the first 2 symbols in the opposite phase. */
+	auto s12 = car.buffer.sum(offset + buffer_length * k / N_SYMBOL_BUFFER);
+	auto s16 = car.buffer.sum(offset + buffer_length * (k + 4) / N_SYMBOL_BUFFER);
+	auto s20 = car.buffer.sum(offset + buffer_length * (k + 8) / N_SYMBOL_BUFFER);
+
+	auto x = int16_to_complex(s16 - s20) - int16_to_complex(s12 - s16);
+	x *= std::complex(1.0f, -1.0f);
+
+	uint64_t ts = car.marker_finder.last_ts - symbol_ns * N_AUDIO_SYMBOLS / 2;
+
+	st_raw_audio_decode_data(st, car, x / std::abs(x), ts, offset);
+}
+
+static inline void st_raw_audio_test_preamble(struct sync_test_output *st, struct st_audio_carrier &car, uint64_t ts)
+{
+	uint32_t f = car.f;
+	uint32_t c1 = car.c / 2;
+	uint64_t symbol_ns = util_mul_div64(c1, 1000000000ULL, f);
+	size_t buffer_length = (size_t)(st->audio_baseband_rate * c1 * N_SYMBOL_BUFFER / f);
 
 	/* Test the preamble pattern 0xF0  */
-	auto s0 = st->audio_buffer.sum(0);
-	auto s4 = st->audio_buffer.sum(buffer_length * 4 / N_SYMBOL_BUFFER);
-	auto s8 = st->audio_buffer.sum(buffer_length * 8 / N_SYMBOL_BUFFER);
-	auto s12 = st->audio_buffer.sum(buffer_length * 12 / N_SYMBOL_BUFFER);
+	auto s0 = car.buffer.sum(0);
+	auto s4 = car.buffer.sum(buffer_length * 4 / N_SYMBOL_BUFFER);
+	auto s8 = car.buffer.sum(buffer_length * 8 / N_SYMBOL_BUFFER);
+	auto s12 = car.buffer.sum(buffer_length * 12 / N_SYMBOL_BUFFER);
 
 	float det8_0 = std::abs(int16_to_complex(s4 - s0) - int16_to_complex(s8 - s4));
 	float det12_8 = det8_0 * 0.5f - std::abs(int16_to_complex(s12 - s8));
 	float det = det8_0 + det12_8;
 
-	UNUSED_PARAMETER(v0);
-	// auto dbg = int16_to_complex(st->audio_buffer.sum(1) - s0);
-	// blog(LOG_INFO, "st_raw_audio-plot: %.05f %f %f %f %f", (ts - st->start_ts) * 1e-9, v0, det, dbg.real(), dbg.imag());
+	/* Wait until the data symbols are received. */
+	if (car.marker_finder.append(det, ts + car.detector_shift_ns, symbol_ns * 2 * n_data_symbols(car.type_flags)))
+		st_raw_audio_marker_found(st, car, 0);
+}
+
+/* Build the baseband waveform of the silence and the preamble 0xF0 as sent by `tool/videogen.py`. */
+static std::vector<float> preamble_template(uint32_t sample_rate, uint32_t f, uint32_t c)
+{
+	const uint32_t n_symbols = MF_SILENT_SYMBOLS + MF_PREAMBLE_SYMBOLS;
+	const size_t m = (size_t)sample_rate * c * n_symbols / f;
+	std::vector<float> t(m);
+
+	for (size_t i = 0; i < m; i++) {
+		float cycles = (float)((double)i * f / sample_rate);
+		int k = (int)(cycles / c) - MF_SILENT_SYMBOLS;
+		float f_sym = fmodf(cycles, (float)c);
+		if (k < 0 || k >= MF_PREAMBLE_SYMBOLS) {
+			t[i] = 0.0f;
+			continue;
+		}
+
+		/* Symbol 3 (-sin) twice, then symbol 0 (sin) twice. */
+		float v = k < 2 ? -1.0f : 1.0f;
+		if ((k == 0 || k == 2) && f_sym < MF_SMOOTH_CYCLES)
+			v *= 0.5f - cosf(f_sym / MF_SMOOTH_CYCLES * (float)M_PI) * 0.5f;
+		else if (k == 1 && c - f_sym < MF_SMOOTH_CYCLES)
+			v *= 0.5f - cosf((c - f_sym) / MF_SMOOTH_CYCLES * (float)M_PI) * 0.5f;
+		t[i] = v;
+	}
+
+	return t;
+}
+
+/* Correlate the baseband with the whole preamble waveform.
+ * The scores are available for a block of samples at once so that the
+ * decoding refers the data `offset` samples before the last sample. */
+static inline void st_raw_audio_test_preamble_mf(struct sync_test_output *st, struct st_audio_carrier &car,
+						 uint64_t ts, std::complex<float> x, size_t buffer_length)
+{
+	if (!car.mf.push(x))
+		return;
+
+	uint32_t c1 = car.c / 2;
+	uint64_t symbol_ns = util_mul_div64(c1, 1000000000ULL, car.f);
+	const size_t l = car.mf.l;
+
+	for (size_t j = 0; j < l; j++) {
+		size_t offset = l - 1 - j;
+		if (car.buffer.buffer.size() < buffer_length + offset)
+			continue;
+
+		uint64_t ts_j = ts + car.detector_shift_ns -
+				util_mul_div64(offset, 1000000000ULL, st->audio_baseband_rate);
+		if (car.marker_finder.append(car.mf.scores[j], ts_j, symbol_ns * 2 * n_data_symbols(car.type_flags)))
+			st_raw_audio_marker_found(st, car, offset);
+	}
+}
+
+/* The onset of a clap makes a sudden increase of the energy in many frequency bins. */
+static void st_raw_audio_clapper(struct sync_test_output *st, struct audio_data *frames)
+{
+	st_stage_scope scope(st->stage_counters[ST_STAGE_PREAMBLE], ST_STAGE_PREAMBLE);
+
+	auto &flux = st->clapper_flux;
+	auto &finder = st->clapper_audio_finder;
+	const uint64_t hop_ns = util_mul_div64(flux.hop, 1000000000ULL, st->audio_sample_rate);
 
-	if (st->audio_marker_finder.append(det, ts, symbol_ns * 12)) {
-		auto s12 = st->audio_buffer.sum(buffer_length * 12 / N_SYMBOL_BUFFER);
-		auto s16 = st->audio_buffer.sum(buffer_length * 16 / N_SYMBOL_BUFFER);
-		auto s20 = st->audio_buffer.sum(buffer_length * 20 / N_SYMBOL_BUFFER);
+	for (uint32_t i = 0; i < frames->frames; i++) {
+		float v = ((float *)frames->data[0])[i];
+		if (st->audio_channels >= 2)
+			v = (v + ((float *)frames->data[1])[i]) * 0.5f;
+		if (!flux.push(v))
+			continue;
+
+		/* The onset is in the last hop of the block. */
+		uint64_t ts = frames->timestamp + util_mul_div64(i + 1, 1000000000ULL, st->audio_sample_rate) - hop_ns;
+		float score = st->clapper_audio_th.apply(flux.flux);
+		if (finder.append(score, ts, hop_ns))
+			clapper_event_found(st, finder.last_ts - st->start_ts, false, finder.last_score);
+	}
+}
+
+/* Follows the pattern found by the video. The buffer is cleared when the pattern changes. */
+static void audio_carrier_update(struct sync_test_output *st, struct st_audio_carrier &car,
+				 const struct st_audio_pattern &p)
+{
+	if (p.f == car.f && p.c == car.c && p.type_flags == car.type_flags)
+		return;
+
+	car.f = p.f;
+	car.c = p.c;
+	car.type_flags = p.type_flags;
+	car.buffer.buffer.clear();
+	car.last_index = -1;
+	car.slip.reset();
+	car.detector_shift_ns = 0;
+	if (!car.f)
+		return;
+
+	/* The lengths in the baseband samples are truncated, which moves the peak of the detector
+	 * by up to a few decimated samples. The shift is in the halves of the input samples. */
+	const uint64_t d = st->audio_decimation;
+	uint64_t shift2;
+	if (st->audio_detector == ST_AUDIO_DETECTOR_MATCHED) {
+		/* The template is sampled at the centers of the decimated samples. */
+		car.mf.init(preamble_template(st->audio_baseband_rate, car.f, car.c));
+		const uint64_t n_symbols = MF_SILENT_SYMBOLS + MF_PREAMBLE_SYMBOLS;
+		const uint64_t m_full = (uint64_t)st->audio_sample_rate * car.c * n_symbols / car.f;
+		shift2 = ((m_full - 1) - (car.mf.m - 1) * d) * 2;
+	}
+	else {
+		/* The last window of the sums ends at the last input sample of the decimated sample. */
+		const uint64_t c1 = car.c / 2;
+		const uint64_t l_full = (uint64_t)st->audio_sample_rate * c1 * N_SYMBOL_BUFFER / car.f;
+		const uint64_t l = (uint64_t)st->audio_baseband_rate * c1 * N_SYMBOL_BUFFER / car.f;
+		const uint64_t w_full = l_full * 4 / N_SYMBOL_BUFFER;
+		const uint64_t w = l * 4 / N_SYMBOL_BUFFER;
+		shift2 = (w_full - w * d) * 2 + d - 1;
+	}
+	car.detector_shift_ns = util_mul_div64(shift2, 1000000000ULL, 2ULL * st->audio_sample_rate);
+}
+
+static void audio_decimation_reset(struct sync_test_output *st)
+{
+	st->audio_decim_n = 0;
+	std::fill(st->audio_decim_re, st->audio_decim_re + AUDIO_MAX_CARRIERS, 0.0f);
+	std::fill(st->audio_decim_im, st->audio_decim_im + AUDIO_MAX_CARRIERS, 0.0f);
+}
+
+/* Called from `st_start` and from the audio thread after `update`.
+ * The decimation divides the sample rate so that the baseband has an exact rate. */
+static void audio_tuning_update(struct sync_test_output *st, const struct st_tuning &tuning)
+{
+	uint32_t d = std::clamp<uint32_t>(tuning.audio_decimation, 1, AUDIO_MAX_DECIMATION);
+	while (d > 1 && st->audio_sample_rate % d)
+		d--;
+	if (d == st->audio_decimation)
+		return;
 
-		auto x = int16_to_complex(s16 - s20) - int16_to_complex(s12 - s16);
-		x *= std::complex(1.0f, -1.0f);
+	st->audio_decimation = d;
+	st->audio_baseband_rate = st->audio_sample_rate / d;
+	audio_decimation_reset(st);
 
-		ts = st->audio_marker_finder.last_ts - symbol_ns * N_AUDIO_SYMBOLS / 2;
+	/* The buffers and the template of the matched filter are in the samples of the previous rate.
+	 * The carriers are set up again from the patterns at the next packet. */
+	for (auto &car : st->carriers)
+		audio_carrier_update(st, car, st_audio_pattern());
 
-		st_raw_audio_decode_data(st, x / std::abs(x), ts);
+	blog(LOG_INFO, "%s: demodulating the audio at %u Hz", obs_output_get_name(st->context),
+	     st->audio_baseband_rate);
+}
+
+/* Mixes all carriers in one pass so that each sample is read only once.
+ * The oscillators are stored by component and the inner loop has a fixed
+ * count so that the loop is vectorized across the carriers.
+ * The oscillators are rotated sample by sample and set again every AUDIO_OSC_BLOCK samples.
+ * The baseband is averaged over `audio_decimation` samples, which is far
+ * shorter than a symbol. */
+static void st_raw_audio_mix(struct sync_test_output *st, struct audio_data *frames)
+{
+	const float *data0 = (const float *)frames->data[0];
+	const float *data1 = st->audio_channels >= 2 ? (const float *)frames->data[1] : nullptr;
+
+	float osc_sin[AUDIO_MAX_CARRIERS], osc_cos[AUDIO_MAX_CARRIERS];
+	float rot_sin[AUDIO_MAX_CARRIERS], rot_cos[AUDIO_MAX_CARRIERS];
+	double phase0[AUDIO_MAX_CARRIERS], step[AUDIO_MAX_CARRIERS];
+	for (int k = 0; k < AUDIO_MAX_CARRIERS; k++) {
+		const uint32_t f = st->carriers[k].f;
+		phase0[k] = fmod((double)(frames->timestamp % 1000000000) * 1e-9 * f, 1.0) * 2 * M_PI;
+		step[k] = 2 * M_PI * f / st->audio_sample_rate;
+		rot_sin[k] = (float)sin(step[k]);
+		rot_cos[k] = (float)cos(step[k]);
+	}
+	auto osc_set = [&](uint32_t i) {
+		for (int k = 0; k < AUDIO_MAX_CARRIERS; k++) {
+			const double phase = phase0[k] + step[k] * i;
+			osc_sin[k] = st->carriers[k].f ? (float)sin(phase) : 0.0f;
+			osc_cos[k] = st->carriers[k].f ? (float)cos(phase) : 0.0f;
+		}
+	};
+
+	const uint32_t d = st->audio_decimation;
+	const float scale = 16383.0f / (float)d;
+	uint32_t n = st->audio_decim_n;
+	float re[AUDIO_MAX_CARRIERS], im[AUDIO_MAX_CARRIERS];
+	std::copy(st->audio_decim_re, st->audio_decim_re + AUDIO_MAX_CARRIERS, re);
+	std::copy(st->audio_decim_im, st->audio_decim_im + AUDIO_MAX_CARRIERS, im);
+
+	auto &baseband = st->audio_baseband;
+	baseband.resize(((size_t)n + frames->frames) / d * AUDIO_MAX_CARRIERS * 2);
+	int16_t *bb = baseband.data();
+	st->audio_baseband_first = d - 1 - n;
+	size_t m = 0;
+
+	for (uint32_t i = 0; i < frames->frames; i++) {
+		if (i % AUDIO_OSC_BLOCK == 0)
+			osc_set(i);
+
+		const float v0 = data0[i];
+		const float v1 = data1 ? data1[i] : 0.0f;
+
+		for (int k = 0; k < AUDIO_MAX_CARRIERS; k++) {
+			const float s = osc_sin[k], c = osc_cos[k];
+			re[k] += v0 * s - v1 * c;
+			im[k] += v0 * c + v1 * s;
+			osc_sin[k] = s * rot_cos[k] + c * rot_sin[k];
+			osc_cos[k] = c * rot_cos[k] - s * rot_sin[k];
+		}
+
+		if (++n < d)
+			continue;
+		n = 0;
+
+		int16_t *bb_re = bb + m++ * AUDIO_MAX_CARRIERS * 2;
+		int16_t *bb_im = bb_re + AUDIO_MAX_CARRIERS;
+		for (int k = 0; k < AUDIO_MAX_CARRIERS; k++) {
+			bb_re[k] = (int16_t)(re[k] * scale);
+			bb_im[k] = (int16_t)(im[k] * scale);
+			re[k] = im[k] = 0.0f;
+		}
+	}
+
+	st->audio_baseband_n = m;
+	st->audio_decim_n = n;
+	std::copy(re, re + AUDIO_MAX_CARRIERS, st->audio_decim_re);
+	std::copy(im, im + AUDIO_MAX_CARRIERS, st->audio_decim_im);
+}
+
+/* Timestamp of the baseband sample `j`, which is at the center of its input samples. */
+static inline uint64_t baseband_timestamp(const struct sync_test_output *st, const struct audio_data *frames, size_t j)
+{
+	const int64_t i2 = 2 * ((int64_t)st->audio_baseband_first + (int64_t)j * st->audio_decimation) -
+			   (st->audio_decimation - 1);
+	if (i2 < 0)
+		return frames->timestamp - util_mul_div64((uint64_t)-i2, 1000000000ULL, 2 * st->audio_sample_rate);
+	return frames->timestamp + util_mul_div64((uint64_t)i2, 1000000000ULL, 2 * st->audio_sample_rate);
+}
+
+static void st_raw_audio_carrier(struct sync_test_output *st, struct st_audio_carrier &car, int k,
+				 struct audio_data *frames, uint32_t q_ms)
+{
+	if (q_ms > 0)
+		car.marker_finder.dumping_range = q_ms * 1000000 * 6 * 2;
+
+	size_t buffer_length = (size_t)(st->audio_baseband_rate * car.c * N_SYMBOL_BUFFER / car.f);
+	const bool use_mf = st->audio_detector == ST_AUDIO_DETECTOR_MATCHED;
+	const size_t buffer_capacity = use_mf ? buffer_length + car.mf.l : buffer_length;
+	const int16_t *bb = st->audio_baseband.data();
+
+	for (size_t j = 0; j < st->audio_baseband_n; j++) {
+		uint64_t ts = baseband_timestamp(st, frames, j);
+		const int16_t xr = bb[j * AUDIO_MAX_CARRIERS * 2 + k];
+		const int16_t xi = bb[j * AUDIO_MAX_CARRIERS * 2 + AUDIO_MAX_CARRIERS + k];
+
+		car.buffer.push_back(xr, xi, buffer_capacity);
+
+		if (use_mf) {
+			auto x = std::complex<float>(xr, xi) * (1.0f / 32768.0f);
+			st_raw_audio_test_preamble_mf(st, car, ts, x, buffer_length);
+			continue;
+		}
+
+		if (car.buffer.buffer.size() < buffer_length)
+			continue;
+
+		st_raw_audio_test_preamble(st, car, ts);
 	}
 }
 
@@ -691,47 +2447,106 @@ static void st_raw_audio(void *data, struct audio_data *frames)
 {
 	auto *st = (struct sync_test_output *)data;
 
-	if (!st->start_ts)
+	st->audio_packets.fetch_add(1, std::memory_order_relaxed);
+	metrics_audio_update(st, frames->timestamp);
+
+	if (auto_stop_frame(st)) {
+		st->audio_packets_skipped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	if (!st->start_ts) {
+		st->audio_packets_skipped.fetch_add(1, std::memory_order_relaxed);
 		return;
+	}
+
+	if (st->tuning_audio_changed.exchange(false))
+		audio_tuning_update(st, tuning_get(st));
+
+	int64_t jump = st->audio_ts_check.packet(frames->timestamp, frames->frames, st->audio_sample_rate);
+	if (jump) {
+		audio_discontinuity_found(st, frames->timestamp, ST_AUDIO_DISCONTINUITY_TIMESTAMP, jump, 0);
 
+		/* The interval of the markers across the jump is not a slip of the samples. */
+		for (auto &car : st->carriers)
+			car.slip.restart();
+		audio_decimation_reset(st);
+	}
+
+	if (st->clapper) {
+		st_raw_audio_clapper(st, frames);
+		return;
+	}
+
+	struct st_audio_pattern patterns[AUDIO_MAX_CARRIERS];
 	std::unique_lock<std::mutex> lock(st->mutex);
-	uint32_t f = st->f;
-	uint32_t c = st->c;
-	uint32_t q_ms = st->q_ms;
+	std::copy(st->patterns, st->patterns + AUDIO_MAX_CARRIERS, patterns);
 	lock.unlock();
 
-	if (f <= 0 || c <= 0)
+	/* Audio follows the state decided by the video frames. The buffers are
+	 * cleared when resuming since the samples are not contiguous. */
+	if (st->watchdog_state.load(std::memory_order_relaxed) == ST_WATCHDOG_SLEEPING) {
+		st->audio_packets_skipped.fetch_add(1, std::memory_order_relaxed);
+		for (auto &car : st->carriers)
+			audio_carrier_update(st, car, st_audio_pattern());
+		audio_decimation_reset(st);
 		return;
+	}
 
-	if (f != st->f_last || c != st->c_last) {
-		st->f_last = f;
-		st->c_last = c;
-		st->audio_buffer.buffer.clear();
+	int n_carriers = 0;
+	for (int k = 0; k < AUDIO_MAX_CARRIERS; k++) {
+		auto &p = patterns[k];
+		if (p.f <= 0 || p.c <= 0 || p.last_ts + AUDIO_CARRIER_EXPIRE_NS < frames->timestamp)
+			p = st_audio_pattern();
+		audio_carrier_update(st, st->carriers[k], p);
+		if (p.f)
+			n_carriers++;
 	}
 
-	if (q_ms > 0)
-		st->audio_marker_finder.dumping_range = q_ms * 1000000 * 6 * 2;
+	if (!n_carriers) {
+		st->audio_packets_skipped.fetch_add(1, std::memory_order_relaxed);
+		audio_decimation_reset(st);
+		return;
+	}
 
-	float phase = (frames->timestamp % 1000000000) * (float)(1e-9 * 2 * M_PI * f);
-	float phase_step = (float)(2 * M_PI * f) / st->audio_sample_rate;
-	size_t buffer_length = (size_t)(st->audio_sample_rate * c * N_SYMBOL_BUFFER / f);
+	{
+		st_stage_scope scope(st->stage_counters[ST_STAGE_AUDIO_MIX], ST_STAGE_AUDIO_MIX);
+		st_raw_audio_mix(st, frames);
+	}
 
-	for (uint32_t i = 0; i < frames->frames; i++) {
-		float osc0 = sinf(phase + phase_step * i);
-		float osc1 = cosf(phase + phase_step * i);
-		uint64_t ts = frames->timestamp + util_mul_div64(i, 1000000000ULL, st->audio_sample_rate);
+	st_stage_scope scope(st->stage_counters[ST_STAGE_PREAMBLE], ST_STAGE_PREAMBLE);
 
-		float v0 = ((float *)frames->data[0])[i];
-		float v1 = st->audio_channels >= 2 ? ((float *)frames->data[1])[i] : 0.0f;
-		int16_t vr = (int16_t)((v0 * osc0 - v1 * osc1) * 16383.0f);
-		int16_t vi = (int16_t)((v0 * osc1 + v1 * osc0) * 16383.0f);
-		st->audio_buffer.push_back(vr, vi, buffer_length);
+	for (int k = 0; k < AUDIO_MAX_CARRIERS; k++) {
+		if (st->carriers[k].f)
+			st_raw_audio_carrier(st, st->carriers[k], k, frames, patterns[k].q_ms);
+	}
+}
 
-		if (st->audio_buffer.buffer.size() < buffer_length)
-			continue;
+static void st_proc_get_stats(void *data, calldata_t *cd)
+{
+	auto *st = (struct sync_test_output *)data;
+	struct st_stats *stats;
+	if (!calldata_get_ptr(cd, "data", &stats) || !stats)
+		return;
 
-		st_raw_audio_test_preamble(st, ts, v0);
-	}
+	stats->elapsed_ns = st->stats_start_ns ? os_gettime_ns() - st->stats_start_ns : 0;
+	stats->video_frames = st->video_frames.load(std::memory_order_relaxed);
+	stats->video_frames_skipped = st->video_frames_skipped.load(std::memory_order_relaxed);
+	stats->audio_packets = st->audio_packets.load(std::memory_order_relaxed);
+	stats->audio_packets_skipped = st->audio_packets_skipped.load(std::memory_order_relaxed);
+	stats->qr_step = st->qr_step.load(std::memory_order_relaxed);
+	stats->video_frame_rate = st->video_frame_rate;
+	stats->video_frames_repeated = st->video_frames_repeated.load(std::memory_order_relaxed);
+	for (int i = 0; i < ST_REPEAT_RUN_BUCKETS; i++)
+		stats->video_repeat_runs[i] = st->video_repeat_runs[i].load(std::memory_order_relaxed);
+	stats->qr_decodes = st->qr_decodes.load(std::memory_order_relaxed);
+	stats->qr_cache_hits = st->qr_cache_hits.load(std::memory_order_relaxed);
+	stats->audio_discontinuities = st->audio_discontinuities.load(std::memory_order_relaxed);
+	stats->audio_samples_dropped = st->audio_samples_dropped.load(std::memory_order_relaxed);
+	stats->audio_samples_inserted = st->audio_samples_inserted.load(std::memory_order_relaxed);
+	stats->audio_crc_errors = st->audio_crc_errors.load(std::memory_order_relaxed);
+	for (int i = 0; i < ST_STAGE_COUNT; i++)
+		st->stage_counters[i].snapshot(stats->stages[i]);
 }
 
 extern "C" void register_sync_test_output()
@@ -740,12 +2555,15 @@ extern "C" void register_sync_test_output()
 	info.id = OUTPUT_ID;
 	info.flags = OBS_OUTPUT_AV;
 	info.get_name = st_get_name;
+	info.get_defaults = st_get_defaults;
 	info.create = st_create;
 	info.destroy = st_destroy;
 	info.start = st_start;
 	info.stop = st_stop;
 	info.raw_video = st_raw_video;
 	info.raw_audio = st_raw_audio;
+	info.update = st_update;
+	info.get_properties = st_get_properties;
 
 	obs_register_output(&info);
 }
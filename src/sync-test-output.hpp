@@ -2,6 +2,27 @@
 
 #include <obs-module.h>
 
+/* Bits of `t=` in the QR code */
+enum st_qr_type_flags {
+	/* The index has 16 bits and the audio has CRC-8 instead of CRC-4. */
+	ST_QR_TYPE_V2 = 0x1,
+};
+
+/* Binary payload of the QR code, all values are little endian.
+ *   [0]      ST_QR_BINARY_V1 or ST_QR_BINARY_TIMECODE
+ *   [1..2]   q
+ *   [3..4]   f
+ *   [5..6]   c
+ *   [7]      t
+ *   [8..9]   i
+ *   [10..11] I - 1
+ *   [12..19] T, only for ST_QR_BINARY_TIMECODE
+ * The text payload always starts with an ASCII character so that the first byte tells the format. */
+#define ST_QR_BINARY_V1 0x81
+#define ST_QR_BINARY_V1_SIZE 12
+#define ST_QR_BINARY_TIMECODE 0x82
+#define ST_QR_BINARY_TIMECODE_SIZE 20
+
 struct st_qr_data
 {
 	uint32_t f = 0;
@@ -10,6 +31,9 @@ struct st_qr_data
 	uint32_t index = -1;
 	uint32_t index_max = 256;
 	uint32_t type_flags = 0;
+	/* `T`, the time in microseconds when the first frame of the sync pattern 1 is shown,
+	 * in the clock of `os_gettime_ns` on the machine running OBS Studio; 0 if not embedded. */
+	uint64_t timecode_us = 0;
 	bool valid = 0;
 
 	bool _decode_kv(char *param)
@@ -42,6 +66,9 @@ struct st_qr_data
 		case 't':
 			type_flags = (uint32_t)atoi(val);
 			return true;
+		case 'T':
+			timecode_us = strtoull(val, NULL, 10);
+			return true;
 		default:
 			/* Ignored */
 			return true;
@@ -50,6 +77,8 @@ struct st_qr_data
 		return false;
 	}
 
+	uint32_t index_mask() const { return type_flags & ST_QR_TYPE_V2 ? 0xFFFF : 0xFF; }
+
 	bool check()
 	{
 		if (f < 10 || 32000 < f) {
@@ -64,16 +93,56 @@ struct st_qr_data
 			blog(LOG_WARNING, "q: out of range: %u", q_ms);
 			return false;
 		}
-		if (index & ~0xFF) {
+		if (index & ~index_mask()) {
 			blog(LOG_WARNING, "i: out of range: %u", index);
 			return false;
 		}
 		return true;
 	}
 
+	bool _decode_binary(const uint8_t *payload, size_t len)
+	{
+		if (payload[0] != ST_QR_BINARY_V1 && payload[0] != ST_QR_BINARY_TIMECODE) {
+			blog(LOG_WARNING, "unsupported binary payload version 0x%02x", payload[0]);
+			return false;
+		}
+		const bool has_timecode = payload[0] == ST_QR_BINARY_TIMECODE;
+		if (len < (has_timecode ? ST_QR_BINARY_TIMECODE_SIZE : ST_QR_BINARY_V1_SIZE)) {
+			blog(LOG_WARNING, "binary payload too short: %d", (int)len);
+			return false;
+		}
+
+		auto u16 = [payload](size_t i) { return (uint32_t)payload[i] | (uint32_t)payload[i + 1] << 8; };
+		q_ms = u16(1);
+		f = u16(3);
+		c = u16(5);
+		type_flags = payload[7];
+		index = u16(8);
+		index_max = u16(10) + 1;
+		for (int i = 7; has_timecode && i >= 0; i--)
+			timecode_us = timecode_us << 8 | payload[12 + i];
+		return true;
+	}
+
+	/* Decodes either the binary or the text payload.
+	 * The text payload is tokenized in place and has to be terminated by NUL. */
+	bool decode(uint8_t *payload, size_t len)
+	{
+		if (len > 0 && payload[0] >= 0x80) {
+			valid = false;
+			timecode_us = 0;
+			if (!_decode_binary(payload, len) || !check())
+				return false;
+			valid = true;
+			return true;
+		}
+		return decode((char *)payload);
+	}
+
 	bool decode(char *payload)
 	{
 		valid = false;
+		timecode_us = 0;
 		char *saveptr;
 		char *param = strtok_r(payload, ",", &saveptr);
 		while (param) {
@@ -88,6 +157,11 @@ struct st_qr_data
 	}
 };
 
+enum st_audio_detector {
+	ST_AUDIO_DETECTOR_ENERGY = 0,
+	ST_AUDIO_DETECTOR_MATCHED = 1,
+};
+
 struct video_marker_found_s
 {
 	uint64_t timestamp;
@@ -101,6 +175,7 @@ struct audio_marker_found_s
 	int index;
 	float score;
 	uint32_t index_max;
+	uint32_t f; // carrier of the pattern
 };
 
 struct sync_index
@@ -109,4 +184,156 @@ struct sync_index
 	uint64_t video_ts = 0;
 	uint64_t audio_ts = 0;
 	uint32_t index_max = 256;
+	uint32_t f = 0; // carrier of the pattern
+};
+
+enum st_audio_discontinuity_type {
+	/* The timestamp of the packet did not follow the previous packet. */
+	ST_AUDIO_DISCONTINUITY_TIMESTAMP = 1,
+	/* The samples slipped while the timestamps were continuous, found from the carrier phase of the markers. */
+	ST_AUDIO_DISCONTINUITY_SLIP = 2,
+};
+
+struct audio_discontinuity_s
+{
+	uint64_t timestamp; // from the start of the output
+	int type;           // enum st_audio_discontinuity_type
+	int64_t samples;    // positive if the following audio is delayed, negative if advanced
+	uint32_t f;         // carrier of the pattern, 0 for the timestamp
+};
+
+/* Delivered frame cadence measured from the pattern */
+struct st_cadence_stats
+{
+	uint32_t expected;         // frames of each state expected from `q` and the frame rate
+	uint64_t states;           // completed states of the pattern
+	uint64_t frames;           // frames in the completed states
+	uint64_t duplicated;       // frames more than expected in the states
+	uint64_t dropped;          // frames less than expected in the states
+	uint64_t intervals;        // intervals of the timestamps measured
+	uint64_t gaps;             // frames missing in the timestamps
+	double interval_mean_ns;   // mean of the intervals of the timestamps
+	double interval_stddev_ns; // standard deviation of the intervals of the timestamps
+	double jitter_max_ns;      // largest deviation of the interval from the nominal one
+};
+
+/* Glass-to-glass latency from the timecode of the pattern to the marker seen in the video */
+struct st_glass_stats
+{
+	int64_t last_ns; // latency of the last marker
+	uint64_t count;
+	double mean_ns;
+	double stddev_ns;
+	int64_t min_ns;
+	int64_t max_ns;
+	int64_t p50_ns; // percentiles in the resolution of 1 ms
+	int64_t p95_ns;
+	int64_t p99_ns;
+};
+
+/* Latency of the pairs of one audio carrier when the measurement has converged */
+struct st_convergence_s
+{
+	uint32_t f; // 0 for the clapperboard mode
+	uint64_t count;
+	double mean_ns; // audio_ts - video_ts
+	double stddev_ns;
+	double ci_ns; // width of the 95% confidence interval of the mean
+};
+
+/* Watchdog mode analyzes one pattern cycle in each interval while the latency is stable.
+ * LEARNING and ALERT analyze all frames until the latency becomes stable. */
+enum st_watchdog_state {
+	ST_WATCHDOG_OFF,
+	ST_WATCHDOG_LEARNING,
+	ST_WATCHDOG_SLEEPING,
+	ST_WATCHDOG_SAMPLING,
+	ST_WATCHDOG_ALERT,
+};
+
+enum st_stage {
+	ST_STAGE_QR_FILL,
+	ST_STAGE_QUIRC,
+	ST_STAGE_MARKER_SUM,
+	ST_STAGE_AUDIO_MIX,
+	ST_STAGE_PREAMBLE,
+	ST_STAGE_MATCHING, // nested in ST_STAGE_MARKER_SUM or ST_STAGE_PREAMBLE
+	ST_STAGE_COUNT,
+};
+
+static inline const char *st_stage_name(enum st_stage stage)
+{
+	static const char *names[ST_STAGE_COUNT] = {
+		"qr-fill", "quirc", "marker-sum", "audio-mix", "preamble", "matching",
+	};
+	return stage < ST_STAGE_COUNT ? names[stage] : "unknown";
+}
+
+/* Bucket `i` of the histogram counts the durations in [2^i, 2^(i+1)) ns. */
+#define ST_STAGE_HIST_BUCKETS 32
+
+struct st_stage_stats
+{
+	uint64_t count = 0;
+	uint64_t total_ns = 0;
+	uint64_t max_ns = 0;
+	uint32_t hist[ST_STAGE_HIST_BUCKETS] = {0};
+
+	uint64_t percentile_ns(float p) const
+	{
+		uint64_t n = 0;
+		for (int i = 0; i < ST_STAGE_HIST_BUCKETS; i++)
+			n += hist[i];
+		uint64_t target = (uint64_t)(n * p);
+		for (int i = 0; i < ST_STAGE_HIST_BUCKETS; i++) {
+			if (hist[i] > target)
+				return 2ULL << i;
+			target -= hist[i];
+		}
+		return max_ns;
+	}
+};
+
+/* Bucket `i` counts the runs of `i + 1` identical frames. The last bucket also counts longer runs. */
+#define ST_REPEAT_RUN_BUCKETS 4
+
+/* Snapshot returned by the procedure `get_stats` of the output. */
+struct st_stats
+{
+	uint64_t elapsed_ns = 0;
+	uint64_t video_frames = 0;
+	uint64_t video_frames_skipped = 0;
+	uint64_t audio_packets = 0;
+	uint64_t audio_packets_skipped = 0;
+	double video_frame_rate = 0.0;
+	uint64_t video_frames_repeated = 0;
+	uint64_t video_repeat_runs[ST_REPEAT_RUN_BUCKETS] = {0};
+	uint32_t qr_step = 0;
+	uint64_t qr_decodes = 0;
+	uint64_t qr_cache_hits = 0;
+	uint64_t audio_discontinuities = 0;  // jumps of the timestamps
+	uint64_t audio_samples_dropped = 0;  // samples dropped while the timestamps were continuous
+	uint64_t audio_samples_inserted = 0; // samples inserted while the timestamps were continuous
+	uint64_t audio_crc_errors = 0;
+	struct st_stage_stats stages[ST_STAGE_COUNT];
+
+	/* Estimate the frame rate of the source from the number of the distinct frames. */
+	double source_frame_rate() const
+	{
+		if (video_frames <= video_frames_skipped - video_frames_repeated)
+			return 0.0;
+		uint64_t analyzed = video_frames - (video_frames_skipped - video_frames_repeated);
+		return video_frame_rate * (double)(analyzed - video_frames_repeated) / (double)analyzed;
+	}
+
+	/* The matching is excluded since it is already counted by the stage that found the marker. */
+	uint64_t total_ns() const
+	{
+		uint64_t t = 0;
+		for (int i = 0; i < ST_STAGE_COUNT; i++) {
+			if (i != ST_STAGE_MATCHING)
+				t += stages[i].total_ns;
+		}
+		return t;
+	}
 };
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ST_OVERLAY_MAX_CODES 8
+#define ST_OVERLAY_CORNERS 4
+
+/* Analysis state of one video frame, sent by the `overlay_update` signal.
+ * Coordinates are in the pixels of the output. */
+struct st_overlay_code
+{
+	int x[ST_OVERLAY_CORNERS];
+	int y[ST_OVERLAY_CORNERS];
+	bool decoded;
+};
+
+struct st_overlay_data
+{
+	uint64_t timestamp;
+
+	int n_codes;
+	struct st_overlay_code codes[ST_OVERLAY_MAX_CODES];
+
+	/* The circles integrated by the marker detection, after `adjust_corners`.
+	 * Circles 0 and 2 are subtracted, circles 1 and 3 are added. */
+	bool has_marker;
+	bool marker_active;
+	int marker_x[ST_OVERLAY_CORNERS];
+	int marker_y[ST_OVERLAY_CORNERS];
+	int marker_r;
+
+	/* Marker level normalized to [-1, 1], valid if `marker_active` is set. */
+	float level;
+};
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,234 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <algorithm>
+#include "sync-test-pattern.hpp"
+
+/* Same as ST_QR_BINARY_V1 and ST_QR_BINARY_TIMECODE */
+#define QR_BINARY_V1 0x81
+#define QR_BINARY_V1_SIZE 12
+#define QR_BINARY_TIMECODE 0x82
+#define QR_BINARY_TIMECODE_SIZE 20
+
+#define MIN_FRAME_SIZE 64
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Same as `crc4` and `crc8` in `tool/videogen.py` */
+static uint32_t crc_calc(uint32_t data, uint32_t size, uint32_t poly, uint32_t width)
+{
+	data <<= width;
+	poly <<= size - 1;
+	for (uint32_t i = size; i > 0; i--) {
+		if (data & (1u << (width - 1 + i)))
+			data ^= poly;
+		poly >>= 1;
+	}
+	return data;
+}
+
+const char *st_pattern::setup()
+{
+	if (!fps_num || !fps_den || !sample_rate)
+		return "invalid frame rate or sample rate";
+	if (width < MIN_FRAME_SIZE || height < MIN_FRAME_SIZE)
+		return "too small frame";
+	if (q < 1 || q_ms() < 1 || q_ms() > 1000)
+		return "q has to be between 1 millisecond and 1 second";
+	if (f < 10 || f > 32000 || f * 2 >= sample_rate)
+		return "f has to be between 10 Hz and the half of the sample rate";
+
+	/* The audio burst lasts while the sync pattern 1 is shown. */
+	if (c == 0)
+		c = (uint32_t)((uint64_t)q * f * fps_den / ((uint64_t)fps_num * audio_symbols()));
+	if (c == 0)
+		return "f is too low for q";
+	if (c > f)
+		return "c has to be f or less";
+
+	/* The audio burst has to end before the QR code of the next cycle ends. */
+	if ((uint64_t)q * 2 * f * fps_den < (uint64_t)c * audio_symbols() * fps_num)
+		return "c is too long for q";
+
+	return nullptr;
+}
+
+size_t st_pattern::payload(uint8_t *buf, size_t size, uint32_t index, uint32_t index_max, uint64_t timecode_us) const
+{
+	if (binary_qr) {
+		/* See ST_QR_BINARY_V1 in `sync-test-output.hpp` */
+		const size_t len = timecode_us ? QR_BINARY_TIMECODE_SIZE : QR_BINARY_V1_SIZE;
+		if (size < len)
+			return 0;
+		auto u16 = [buf](size_t i, uint32_t v) {
+			buf[i] = (uint8_t)v;
+			buf[i + 1] = (uint8_t)(v >> 8);
+		};
+		buf[0] = timecode_us ? QR_BINARY_TIMECODE : QR_BINARY_V1;
+		u16(1, q_ms());
+		u16(3, f);
+		u16(5, c);
+		buf[7] = (uint8_t)type_flags;
+		u16(8, index);
+		u16(10, index_max - 1);
+		for (int i = 0; timecode_us && i < 8; i++)
+			buf[12 + i] = (uint8_t)(timecode_us >> (i * 8));
+		return len;
+	}
+
+	int len = snprintf((char *)buf, size, "q=%u,i=%u,f=%u,c=%u,t=%u,I=%u", q_ms(), index, f, c, type_flags,
+			   index_max);
+	if (len > 0 && timecode_us && (size_t)len < size)
+		len += snprintf((char *)buf + len, size - len, ",T=%" PRIu64, timecode_us);
+	if (len < 0 || (size_t)len >= size)
+		return 0;
+	return (size_t)len;
+}
+
+void st_pattern::render_qrcode(uint8_t *luma, size_t linesize, const st_qrcode &qr) const
+{
+	/* The QR code with the quiet zone is scaled to the shorter side and centered. */
+	const uint32_t size = std::min(width, height);
+	const uint32_t x0 = (width - size) / 2;
+	const uint32_t y0 = (height - size) / 2;
+	const int n = qr.size + ST_QRENCODE_BORDER * 2;
+
+	std::vector<uint8_t> line(size);
+	int my_prev = -1;
+	for (uint32_t y = 0; y < height; y++) {
+		uint8_t *dst = luma + linesize * y;
+		if (y < y0 || y0 + size <= y) {
+			memset(dst, ST_PATTERN_QR_BACKGROUND, width);
+			continue;
+		}
+
+		/* Nearest module to the center of the pixel */
+		const int my = (int)(((uint64_t)(y - y0) * 2 + 1) * n / (size * 2)) - ST_QRENCODE_BORDER;
+		if (my != my_prev) {
+			for (uint32_t x = 0; x < size; x++) {
+				const int mx = (int)(((uint64_t)x * 2 + 1) * n / (size * 2)) - ST_QRENCODE_BORDER;
+				bool inside = 0 <= mx && mx < qr.size && 0 <= my && my < qr.size;
+				line[x] = inside && qr.dark(mx, my) ? 0 : 255;
+			}
+			my_prev = my;
+		}
+		memset(dst, ST_PATTERN_QR_BACKGROUND, x0);
+		memcpy(dst + x0, line.data(), size);
+		memset(dst + x0 + size, ST_PATTERN_QR_BACKGROUND, width - x0 - size);
+	}
+}
+
+void st_pattern::render_sync(uint8_t *luma, size_t linesize, int ix) const
+{
+	/* The sync pattern 0 has white top-left and bottom-right quadrants, the sync pattern 1 has the others. */
+	const uint32_t w = width / 2, h = height / 2;
+	for (uint32_t y = 0; y < height; y++) {
+		uint8_t *dst = luma + linesize * y;
+		memset(dst, 0, width);
+		if (y >= h * 2)
+			continue;
+		const bool top = y < h;
+		const uint32_t x_white = top == (ix == 0) ? 0 : w;
+		memset(dst + x_white, 255, w);
+	}
+}
+
+void st_pattern::audio_burst(float *dst, uint32_t index, uint64_t j0, size_t n) const
+{
+	const bool v2 = type_flags & ST_PATTERN_TYPE_V2;
+	uint32_t data, n_bit;
+	if (v2) {
+		data = 0xF00000 | (index & 0xFFFF);
+		data = data << 8 | crc_calc(data, 24, 0x107, 8);
+		n_bit = 32;
+	}
+	else {
+		data = 0xF000 | (index & 0xFF);
+		data = data << 4 | crc_calc(data, 16, 0x13, 4);
+		n_bit = 20;
+	}
+
+	const uint64_t symbol_len = (uint64_t)sample_rate * c;
+	for (size_t k = 0; k < n; k++) {
+		const uint64_t j = j0 + k;
+		const double phase = 2.0 * M_PI * (double)(j * f % sample_rate) / sample_rate;
+		const double f_sym = (double)(j * f % symbol_len) / sample_rate;
+		const uint32_t i_sym = (uint32_t)(j * f / symbol_len);
+		const int i_data = (int)n_bit - (int)i_sym * 2 - 2;
+
+		const int sym = (int)(data >> i_data) & 3;
+		const int sym_prev = i_sym > 0 ? (int)(data >> (i_data + 2)) & 3 : -1;
+		const int sym_next = i_data >= 2 ? (int)(data >> (i_data - 2)) & 3 : -1;
+
+		double sample;
+		switch (sym) {
+		case 0:
+			sample = sin(phase);
+			break;
+		case 1:
+			sample = cos(phase);
+			break;
+		case 3:
+			sample = -sin(phase);
+			break;
+		default:
+			sample = -cos(phase);
+			break;
+		}
+
+		/* Square wave, or raised cosine at the phase changes */
+		if (rectangle)
+			sample = sample > 0.0 ? 1.0 : -1.0;
+		else if (f_sym < smooth && sym != sym_prev)
+			sample *= 0.5 - cos(f_sym / smooth * M_PI) * 0.5;
+		else if (c - f_sym < smooth && sym != sym_next)
+			sample *= 0.5 - cos((c - f_sym) / smooth * M_PI) * 0.5;
+
+		dst[k] = (float)sample * amplitude;
+	}
+}
+
+void st_pattern::audio_fill(float *dst, uint64_t s0, size_t n, uint64_t frame0, uint64_t n_cycles) const
+{
+	memset(dst, 0, sizeof(float) * n);
+
+	const uint64_t s1 = s0 + n;
+	const uint64_t len = burst_samples();
+	const uint64_t frame = mul_div(s0, fps_num, (uint64_t)sample_rate * fps_den);
+	uint64_t k = frame > frame0 ? (frame - frame0) / cycle_frames() : 0;
+	if (k > 0)
+		k--;
+
+	for (; !n_cycles || k < n_cycles; k++) {
+		/* Rounded in the same way as `videogen.py` so that the samples are identical. */
+		const uint64_t b = frame_sample(frame0 + k * cycle_frames()) + frame_sample(q * 2);
+		if (b >= s1)
+			break;
+		const uint64_t a0 = std::max(b, s0);
+		const uint64_t a1 = std::min(b + len, s1);
+		if (a0 < a1)
+			audio_burst(dst + (a0 - s0), (uint32_t)(k % index_modulus()), a0 - b, (size_t)(a1 - a0));
+	}
+}
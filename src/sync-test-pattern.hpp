@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sync-test-qrencode.hpp"
+
+/* The synchronization pattern of `tool/videogen.py`, rendered without OBS
+ * Studio so that it is shared by the generator source and the native tool.
+ * Each cycle has `q` frames of the QR code, `q` frames of the sync pattern 0,
+ * and `q` frames of the sync pattern 1. The audio burst of the cycle starts
+ * with the first frame of the sync pattern 1.
+ * The frames and the samples are counted from the start of the pattern. */
+
+/* Bit of `t=` in the QR code, same as ST_QR_TYPE_V2 */
+#define ST_PATTERN_TYPE_V2 0x1
+
+/* Gray level around the QR code */
+#define ST_PATTERN_QR_BACKGROUND 127
+
+struct st_pattern
+{
+	uint32_t fps_num = 30;
+	uint32_t fps_den = 1;
+	uint32_t sample_rate = 48000;
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t q = 4;
+	uint32_t f = 884;
+	uint32_t c = 0; // 0 to fill the sync pattern 1 with the audio burst
+	uint32_t type_flags = 0;
+	bool binary_qr = false;
+	float amplitude = 0.8f;
+	float smooth = 0.25f; // symbols to ramp the amplitude at a phase change
+	bool rectangle = false;
+
+	/* Calculates `c` if not given and checks the settings.
+	 * Returns NULL if the pattern can be generated, otherwise the reason. */
+	const char *setup();
+
+	uint32_t index_modulus() const { return type_flags & ST_PATTERN_TYPE_V2 ? 0x10000 : 0x100; }
+	uint32_t audio_symbols() const { return type_flags & ST_PATTERN_TYPE_V2 ? 16 : 10; }
+	uint32_t cycle_frames() const { return q * 3; }
+	uint32_t q_ms() const { return (uint32_t)((uint64_t)q * 1000 * fps_den / fps_num); }
+
+	/* First audio sample of frame `n` */
+	uint64_t frame_sample(uint64_t n) const { return mul_div(n, (uint64_t)sample_rate * fps_den, fps_num); }
+
+	/* Time of frame `n` in nanoseconds */
+	uint64_t frame_time_ns(uint64_t n) const { return mul_div(n, 1000000000ULL * fps_den, fps_num); }
+
+	/* Number of samples of the audio burst */
+	uint64_t burst_samples() const { return (uint64_t)audio_symbols() * c * sample_rate / f; }
+
+	/* Writes the payload of the QR code for the cycle to `buf` and returns its length.
+	 * `timecode_us` is embedded as `T` unless 0. */
+	size_t payload(uint8_t *buf, size_t size, uint32_t index, uint32_t index_max, uint64_t timecode_us) const;
+
+	/* Renders the frames to a plane of 8-bit luma with full range. */
+	void render_qrcode(uint8_t *luma, size_t linesize, const st_qrcode &qr) const;
+	void render_sync(uint8_t *luma, size_t linesize, int ix) const;
+
+	/* Fills the samples [s0, s0 + n) with the audio bursts.
+	 * The pattern starts at the frame `frame0` and is repeated `n_cycles` times, or endlessly if 0. */
+	void audio_fill(float *dst, uint64_t s0, size_t n, uint64_t frame0 = 0, uint64_t n_cycles = 0) const;
+
+private:
+	static uint64_t mul_div(uint64_t n, uint64_t mul, uint64_t div) { return n / div * mul + n % div * mul / div; }
+	void audio_burst(float *dst, uint32_t index, uint64_t j0, size_t n) const;
+};
@@ -0,0 +1,137 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <obs-module.h>
+#include <util/threading.h>
+#include <util/platform.h>
+#include <algorithm>
+#include "sync-test-pool.hpp"
+
+#include "plugin-macros.generated.h"
+
+/* Half of the logical cores are left for OBS itself.
+ * The callers of `run` are also counted as one of the analysis threads. */
+#define SHARED_POOL_MAX_THREADS 8
+
+static std::mutex shared_mutex;
+static std::weak_ptr<st_worker_pool> shared_pool;
+
+std::shared_ptr<st_worker_pool> st_worker_pool::shared()
+{
+	std::unique_lock<std::mutex> lock(shared_mutex);
+	std::shared_ptr<st_worker_pool> pool = shared_pool.lock();
+	if (pool)
+		return pool;
+
+	int n = std::min(os_get_logical_cores() / 2, SHARED_POOL_MAX_THREADS);
+	pool = std::make_shared<st_worker_pool>((size_t)std::max(n - 1, 0));
+	shared_pool = pool;
+	blog(LOG_INFO, "created shared analysis pool with %zu worker(s)", pool->size());
+	return pool;
+}
+
+st_worker_pool::st_worker_pool(size_t n_threads)
+{
+	for (size_t i = 0; i < n_threads; i++)
+		threads.emplace_back(&st_worker_pool::worker, this);
+}
+
+st_worker_pool::~st_worker_pool()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	stopping = true;
+	lock.unlock();
+	cv.notify_all();
+
+	for (auto &t : threads)
+		t.join();
+}
+
+bool st_worker_pool::take_task(std::unique_lock<std::mutex> &, job **j, size_t *i)
+{
+	if (jobs.empty() || active > threads.size())
+		return false;
+
+	*j = jobs.front();
+	*i = (*j)->next++;
+	if ((*j)->next >= (*j)->n)
+		jobs.pop_front();
+	return true;
+}
+
+void st_worker_pool::run_task(std::unique_lock<std::mutex> &lock, job *j, size_t i)
+{
+	active++;
+	lock.unlock();
+	(*j->func)(i);
+	lock.lock();
+	active--;
+
+	/* `j` might be destroyed by the caller of `run` once `done` reaches `n`.
+	 * Both the callers and the workers wait for a free slot and for the completion. */
+	j->done++;
+	cv.notify_all();
+}
+
+void st_worker_pool::worker()
+{
+	os_set_thread_name("sync-test-pool");
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		job *j;
+		size_t i;
+		if (take_task(lock, &j, &i)) {
+			run_task(lock, j, i);
+			continue;
+		}
+
+		if (stopping)
+			break;
+
+		cv.wait(lock);
+	}
+}
+
+void st_worker_pool::run(size_t n, const std::function<void(size_t)> &func)
+{
+	if (n == 0)
+		return;
+
+	job j;
+	j.func = &func;
+	j.n = n;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobs.push_back(&j);
+	if (n > 1)
+		cv.notify_all();
+
+	/* Process the tasks on the calling thread too while a slot is free. The
+	 * tasks of other jobs queued before this job are also processed so that
+	 * no job waits for another job indefinitely. */
+	while (j.done < n) {
+		job *jj;
+		size_t i;
+		if (take_task(lock, &jj, &i))
+			run_task(lock, jj, i);
+		else
+			cv.wait(lock);
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A small persistent thread pool to split a frame into bands.
+ * `run` can be called from several threads at the same time.
+ * The calling thread also processes the tasks so that `run` does not
+ * depend on the workers to make progress. Up to `size() + 1` tasks run at the
+ * same time, including the tasks run by the callers, so that the CPU usage is
+ * bounded even if several callers run a single task. */
+class st_worker_pool {
+public:
+	st_worker_pool(size_t n_threads);
+	~st_worker_pool();
+
+	/* Returns the pool shared by all outputs so that the number of the
+	 * analysis threads is bounded regardless of the number of sessions.
+	 * The pool is destroyed when the last reference is released. */
+	static std::shared_ptr<st_worker_pool> shared();
+
+	size_t size() const { return threads.size(); }
+
+	/* Call `func(i)` for each `i` in [0, n) and wait until all calls return.
+	 * `func` must not call `run`. */
+	void run(size_t n, const std::function<void(size_t)> &func);
+
+private:
+	struct job
+	{
+		const std::function<void(size_t)> *func;
+		size_t n;
+		size_t next = 0;
+		size_t done = 0;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<job *> jobs;
+	std::vector<std::thread> threads;
+	size_t active = 0;
+	bool stopping = false;
+
+	void worker();
+	bool take_task(std::unique_lock<std::mutex> &lock, job **j, size_t *i);
+	void run_task(std::unique_lock<std::mutex> &lock, job *j, size_t i);
+};
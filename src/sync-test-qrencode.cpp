@@ -0,0 +1,428 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <algorithm>
+#include "sync-test-qrencode.hpp"
+
+/* Error correction level M, indexed by the version */
+static const int ecc_codewords_per_block[ST_QRENCODE_MAX_VERSION + 1] = {
+	0, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26,
+};
+static const int n_ecc_blocks[ST_QRENCODE_MAX_VERSION + 1] = {
+	0, 1, 1, 1, 2, 2, 4, 4, 4, 5, 5,
+};
+
+/* Format bits of the error correction level M */
+#define ECL_M_BITS 0
+
+#define PENALTY_N1 3
+#define PENALTY_N2 3
+#define PENALTY_N3 40
+#define PENALTY_N4 10
+
+/* Number of the codewords available for the data and the error correction */
+static int raw_codewords(int ver)
+{
+	int n = (16 * ver + 128) * ver + 64;
+	if (ver >= 2) {
+		int n_align = ver / 7 + 2;
+		n -= (25 * n_align - 10) * n_align - 55;
+		if (ver >= 7)
+			n -= 36;
+	}
+	return n / 8;
+}
+
+static int data_codewords(int ver)
+{
+	return raw_codewords(ver) - ecc_codewords_per_block[ver] * n_ecc_blocks[ver];
+}
+
+static uint8_t gf_mul(uint8_t x, uint8_t y)
+{
+	int z = 0;
+	for (int i = 7; i >= 0; i--) {
+		z = (z << 1) ^ ((z >> 7) * 0x11D);
+		z ^= ((y >> i) & 1) * x;
+	}
+	return (uint8_t)z;
+}
+
+/* Reed-Solomon generator polynomial of `degree`, the coefficient of the highest term is omitted. */
+static std::vector<uint8_t> rs_divisor(int degree)
+{
+	std::vector<uint8_t> d(degree, 0);
+	d[degree - 1] = 1;
+	uint8_t root = 1;
+	for (int i = 0; i < degree; i++) {
+		for (int j = 0; j < degree; j++) {
+			d[j] = gf_mul(d[j], root);
+			if (j + 1 < degree)
+				d[j] ^= d[j + 1];
+		}
+		root = gf_mul(root, 0x02);
+	}
+	return d;
+}
+
+static std::vector<uint8_t> rs_remainder(const uint8_t *data, size_t len, const std::vector<uint8_t> &divisor)
+{
+	std::vector<uint8_t> r(divisor.size(), 0);
+	for (size_t i = 0; i < len; i++) {
+		uint8_t factor = data[i] ^ r[0];
+		r.erase(r.begin());
+		r.push_back(0);
+		for (size_t j = 0; j < r.size(); j++)
+			r[j] ^= gf_mul(divisor[j], factor);
+	}
+	return r;
+}
+
+/* Splits the data into the blocks, appends the error correction, and interleaves them. */
+static std::vector<uint8_t> add_ecc_and_interleave(const std::vector<uint8_t> &data, int ver)
+{
+	const int n_blocks = n_ecc_blocks[ver];
+	const int ecc_len = ecc_codewords_per_block[ver];
+	const int raw = raw_codewords(ver);
+	const int n_short = n_blocks - raw % n_blocks;
+	const int short_len = raw / n_blocks;
+	const auto divisor = rs_divisor(ecc_len);
+
+	std::vector<std::vector<uint8_t>> blocks;
+	size_t k = 0;
+	for (int i = 0; i < n_blocks; i++) {
+		/* A short block has a padding byte so that all blocks have the same length while interleaving. */
+		size_t n_data = short_len - ecc_len + (i < n_short ? 0 : 1);
+		std::vector<uint8_t> b(data.begin() + k, data.begin() + k + n_data);
+		k += n_data;
+		auto ecc = rs_remainder(b.data(), b.size(), divisor);
+		if (i < n_short)
+			b.push_back(0);
+		b.insert(b.end(), ecc.begin(), ecc.end());
+		blocks.push_back(b);
+	}
+
+	std::vector<uint8_t> res;
+	for (size_t i = 0; i < blocks[0].size(); i++) {
+		for (int j = 0; j < n_blocks; j++) {
+			if (i != (size_t)(short_len - ecc_len) || j >= n_short)
+				res.push_back(blocks[j][i]);
+		}
+	}
+	return res;
+}
+
+namespace {
+
+struct qr_matrix
+{
+	int size;
+	std::vector<uint8_t> dark;
+	std::vector<uint8_t> function;
+
+	explicit qr_matrix(int size_) : size(size_), dark(size_ * size_, 0), function(size_ * size_, 0) {}
+
+	void set_function(int x, int y, bool d)
+	{
+		dark[y * size + x] = d;
+		function[y * size + x] = 1;
+	}
+
+	bool get(int x, int y) const { return dark[y * size + x] != 0; }
+	bool is_function(int x, int y) const { return function[y * size + x] != 0; }
+
+	void draw_finder(int cx, int cy)
+	{
+		for (int dy = -4; dy <= 4; dy++) {
+			for (int dx = -4; dx <= 4; dx++) {
+				int x = cx + dx, y = cy + dy;
+				if (x < 0 || size <= x || y < 0 || size <= y)
+					continue;
+				int dist = std::max(abs(dx), abs(dy));
+				set_function(x, y, dist != 2 && dist != 4);
+			}
+		}
+	}
+
+	void draw_alignment(int cx, int cy)
+	{
+		for (int dy = -2; dy <= 2; dy++) {
+			for (int dx = -2; dx <= 2; dx++)
+				set_function(cx + dx, cy + dy, std::max(abs(dx), abs(dy)) != 1);
+		}
+	}
+
+	void draw_format(int mask)
+	{
+		int data = ECL_M_BITS << 3 | mask;
+		int rem = data;
+		for (int i = 0; i < 10; i++)
+			rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+		int bits = (data << 10 | rem) ^ 0x5412;
+		auto bit = [bits](int i) { return ((bits >> i) & 1) != 0; };
+
+		for (int i = 0; i <= 5; i++)
+			set_function(8, i, bit(i));
+		set_function(8, 7, bit(6));
+		set_function(8, 8, bit(7));
+		set_function(7, 8, bit(8));
+		for (int i = 9; i < 15; i++)
+			set_function(14 - i, 8, bit(i));
+
+		for (int i = 0; i < 8; i++)
+			set_function(size - 1 - i, 8, bit(i));
+		for (int i = 8; i < 15; i++)
+			set_function(8, size - 15 + i, bit(i));
+		set_function(8, size - 8, true);
+	}
+
+	void draw_version(int ver)
+	{
+		if (ver < 7)
+			return;
+		int rem = ver;
+		for (int i = 0; i < 12; i++)
+			rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+		long bits = (long)ver << 12 | rem;
+		for (int i = 0; i < 18; i++) {
+			bool d = ((bits >> i) & 1) != 0;
+			int a = size - 11 + i % 3;
+			int b = i / 3;
+			set_function(a, b, d);
+			set_function(b, a, d);
+		}
+	}
+
+	void draw_function_patterns(int ver)
+	{
+		for (int i = 0; i < size; i++) {
+			set_function(6, i, i % 2 == 0);
+			set_function(i, 6, i % 2 == 0);
+		}
+
+		draw_finder(3, 3);
+		draw_finder(size - 4, 3);
+		draw_finder(3, size - 4);
+
+		if (ver >= 2) {
+			int n_align = ver / 7 + 2;
+			int step = (ver * 4 + n_align * 2 + 1) / (n_align * 2 - 2) * 2;
+			std::vector<int> pos(n_align);
+			pos[0] = 6;
+			for (int i = n_align - 1, p = size - 7; i >= 1; i--, p -= step)
+				pos[i] = p;
+			for (int i = 0; i < n_align; i++) {
+				for (int j = 0; j < n_align; j++) {
+					/* Skip the corners of the finder patterns. */
+					const bool first_i = i == 0, first_j = j == 0;
+					if ((first_i && first_j) || (first_i && j == n_align - 1) ||
+					    (i == n_align - 1 && first_j))
+						continue;
+					draw_alignment(pos[i], pos[j]);
+				}
+			}
+		}
+
+		/* Reserve the area, the actual format is drawn with the mask. */
+		draw_format(0);
+		draw_version(ver);
+	}
+
+	void draw_codewords(const std::vector<uint8_t> &data)
+	{
+		size_t i = 0;
+		for (int right = size - 1; right >= 1; right -= 2) {
+			if (right == 6)
+				right = 5;
+			for (int vert = 0; vert < size; vert++) {
+				for (int j = 0; j < 2; j++) {
+					int x = right - j;
+					bool upward = ((right + 1) & 2) == 0;
+					int y = upward ? size - 1 - vert : vert;
+					if (!is_function(x, y) && i < data.size() * 8) {
+						dark[y * size + x] = (data[i >> 3] >> (7 - (i & 7))) & 1;
+						i++;
+					}
+				}
+			}
+		}
+	}
+
+	void apply_mask(int mask)
+	{
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				bool invert;
+				switch (mask) {
+				case 0:
+					invert = (x + y) % 2 == 0;
+					break;
+				case 1:
+					invert = y % 2 == 0;
+					break;
+				case 2:
+					invert = x % 3 == 0;
+					break;
+				case 3:
+					invert = (x + y) % 3 == 0;
+					break;
+				case 4:
+					invert = (x / 3 + y / 2) % 2 == 0;
+					break;
+				case 5:
+					invert = x * y % 2 + x * y % 3 == 0;
+					break;
+				case 6:
+					invert = (x * y % 2 + x * y % 3) % 2 == 0;
+					break;
+				default:
+					invert = ((x + y) % 2 + x * y % 3) % 2 == 0;
+					break;
+				}
+				if (invert && !is_function(x, y))
+					dark[y * size + x] ^= 1;
+			}
+		}
+	}
+
+	/* The penalty score of the specification to choose the mask. */
+	long penalty() const
+	{
+		long result = 0;
+
+		for (int pass = 0; pass < 2; pass++) {
+			for (int a = 0; a < size; a++) {
+				auto at = [&](int b) { return pass == 0 ? get(b, a) : get(a, b); };
+				int run = 1;
+				for (int b = 1; b <= size; b++) {
+					if (b < size && at(b) == at(b - 1)) {
+						run++;
+						continue;
+					}
+					if (run >= 5)
+						result += PENALTY_N1 + (run - 5);
+					run = 1;
+				}
+
+				/* 1:1:3:1:1 pattern with 4 light modules on one side */
+				auto finder_like = [&](int b) {
+					return at(b) && !at(b + 1) && at(b + 2) && at(b + 3) && at(b + 4) &&
+					       !at(b + 5) && at(b + 6);
+				};
+				for (int b = 0; b + 7 <= size; b++) {
+					if (!finder_like(b))
+						continue;
+					bool before = true, after = true;
+					for (int k = 1; k <= 4; k++) {
+						if (b - k >= 0 && at(b - k))
+							before = false;
+						if (b + 6 + k < size && at(b + 6 + k))
+							after = false;
+					}
+					if (before || after)
+						result += PENALTY_N3;
+				}
+			}
+		}
+
+		for (int y = 0; y + 1 < size; y++) {
+			for (int x = 0; x + 1 < size; x++) {
+				bool c = get(x, y);
+				if (c == get(x + 1, y) && c == get(x, y + 1) && c == get(x + 1, y + 1))
+					result += PENALTY_N2;
+			}
+		}
+
+		long n_dark = 0;
+		for (uint8_t d : dark)
+			n_dark += d;
+		long total = (long)size * size;
+		long k = (labs(n_dark * 20 - total * 10) + total - 1) / total - 1;
+		result += std::max(k, 0L) * PENALTY_N4;
+
+		return result;
+	}
+};
+
+} // namespace
+
+bool st_qrcode::encode(const uint8_t *data, size_t len)
+{
+	int ver;
+	for (ver = 1; ver <= ST_QRENCODE_MAX_VERSION; ver++) {
+		int count_bits = ver <= 9 ? 8 : 16;
+		if (4 + count_bits + len * 8 <= (size_t)data_codewords(ver) * 8)
+			break;
+	}
+	if (ver > ST_QRENCODE_MAX_VERSION)
+		return false;
+
+	/* Byte mode */
+	const size_t capacity = (size_t)data_codewords(ver);
+	std::vector<uint8_t> cw;
+	uint32_t acc = 0;
+	int n_acc = 0;
+	auto append_bits = [&](uint32_t v, int n) {
+		for (int i = n - 1; i >= 0; i--) {
+			acc = acc << 1 | ((v >> i) & 1);
+			if (++n_acc == 8) {
+				cw.push_back((uint8_t)acc);
+				acc = 0;
+				n_acc = 0;
+			}
+		}
+	};
+	append_bits(0x4, 4);
+	append_bits((uint32_t)len, ver <= 9 ? 8 : 16);
+	for (size_t i = 0; i < len; i++)
+		append_bits(data[i], 8);
+	for (int i = 0; i < 4 && cw.size() < capacity; i++)
+		append_bits(0, 1);
+	if (n_acc)
+		append_bits(0, 8 - n_acc);
+	for (uint8_t pad = 0xEC; cw.size() < capacity; pad ^= 0xEC ^ 0x11)
+		cw.push_back(pad);
+
+	const auto all = add_ecc_and_interleave(cw, ver);
+
+	qr_matrix m(ver * 4 + 17);
+	m.draw_function_patterns(ver);
+	m.draw_codewords(all);
+
+	int best_mask = 0;
+	long best_penalty = -1;
+	for (int mask = 0; mask < 8; mask++) {
+		m.apply_mask(mask);
+		m.draw_format(mask);
+		long p = m.penalty();
+		if (best_penalty < 0 || p < best_penalty) {
+			best_mask = mask;
+			best_penalty = p;
+		}
+		m.apply_mask(mask);
+	}
+	m.apply_mask(best_mask);
+	m.draw_format(best_mask);
+
+	version = ver;
+	size = m.size;
+	modules = m.dark;
+	return true;
+}
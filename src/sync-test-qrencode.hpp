@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/* Encoder of the QR code for the pattern generators.
+ * Only the byte mode and the error correction level M are supported, the
+ * same as `tool/videogen.py` generates with the `qrcode` package.
+ * Versions up to ST_QRENCODE_MAX_VERSION hold up to 213 bytes, which is
+ * more than enough for the payload of the pattern. */
+
+#define ST_QRENCODE_MAX_VERSION 10
+
+/* Modules of the quiet zone around the symbol, same as the `qrcode` package. */
+#define ST_QRENCODE_BORDER 4
+
+struct st_qrcode
+{
+	int version = 0;
+	int size = 0;                 // modules on a side, without the quiet zone
+	std::vector<uint8_t> modules; // row major, 1 for dark
+
+	/* Encodes `data` on the smallest version. Returns false if it does not fit. */
+	bool encode(const uint8_t *data, size_t len);
+
+	bool dark(int x, int y) const { return modules[(size_t)y * size + x] != 0; }
+};
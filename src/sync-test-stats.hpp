@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <util/platform.h>
+#ifdef ENABLE_PROFILE
+#include <util/profiler.h>
+#endif
+#include "sync-test-output.hpp"
+
+/* Cheap always-on counters for each processing stage.
+ * Each counter is updated with relaxed atomics so that the dock can read
+ * them while the video and audio threads are running. */
+struct st_stage_counter
+{
+	std::atomic<uint64_t> count{0};
+	std::atomic<uint64_t> total_ns{0};
+	std::atomic<uint64_t> max_ns{0};
+	std::atomic<uint32_t> hist[ST_STAGE_HIST_BUCKETS];
+
+	st_stage_counter() { reset(); }
+
+	void reset()
+	{
+		count.store(0, std::memory_order_relaxed);
+		total_ns.store(0, std::memory_order_relaxed);
+		max_ns.store(0, std::memory_order_relaxed);
+		for (auto &h : hist)
+			h.store(0, std::memory_order_relaxed);
+	}
+
+	static inline int bucket(uint64_t ns)
+	{
+		int b = 0;
+		while (ns >>= 1)
+			b++;
+		return std::min(b, ST_STAGE_HIST_BUCKETS - 1);
+	}
+
+	void add(uint64_t ns)
+	{
+		count.fetch_add(1, std::memory_order_relaxed);
+		total_ns.fetch_add(ns, std::memory_order_relaxed);
+		hist[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t m = max_ns.load(std::memory_order_relaxed);
+		while (ns > m && !max_ns.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+			;
+	}
+
+	void snapshot(struct st_stage_stats &s) const
+	{
+		s.count = count.load(std::memory_order_relaxed);
+		s.total_ns = total_ns.load(std::memory_order_relaxed);
+		s.max_ns = max_ns.load(std::memory_order_relaxed);
+		for (int i = 0; i < ST_STAGE_HIST_BUCKETS; i++)
+			s.hist[i] = hist[i].load(std::memory_order_relaxed);
+	}
+};
+
+/* Measures one stage from the construction to the destruction.
+ * If built with ENABLE_PROFILE, the scope also appears in the libobs profiler. */
+class st_stage_scope {
+	st_stage_counter &counter;
+#ifdef ENABLE_PROFILE
+	const char *name;
+#endif
+	uint64_t start_ns;
+
+public:
+	st_stage_scope(st_stage_counter &counter_, enum st_stage stage) : counter(counter_)
+	{
+#ifdef ENABLE_PROFILE
+		name = st_stage_name(stage);
+		profile_start(name);
+#else
+		UNUSED_PARAMETER(stage);
+#endif
+		start_ns = os_gettime_ns();
+	}
+
+	~st_stage_scope()
+	{
+		counter.add(os_gettime_ns() - start_ns);
+#ifdef ENABLE_PROFILE
+		profile_end(name);
+#endif
+	}
+};
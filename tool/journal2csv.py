@@ -0,0 +1,132 @@
+#! /usr/bin/env python3
+'''
+Convert the journal file written by the sync-test-output to CSV.
+'''
+
+import argparse
+import csv
+import struct
+import sys
+
+HEADER_FORMAT = '<8sIIIIQ32x'
+RECORD_HEADER_FORMAT = '<QQIIQ'
+MAGIC = b'STJRNL01'
+VERSION = 1
+
+TYPE_NAMES = {
+    1: 'start',
+    2: 'qrcode',
+    3: 'video_marker',
+    4: 'audio_marker',
+    5: 'sync',
+    6: 'audio_discontinuity',
+    7: 'glass_latency',
+    8: 'converged',
+}
+
+DISCONTINUITY_KINDS = {
+    1: 'timestamp',
+    2: 'slip',
+}
+
+COLUMNS = [
+    'seq', 'time_ns', 'type', 'index', 'timestamp_ns',
+    'score', 'index_max', 'f', 'c', 'q_ms',
+    'x0', 'y0', 'x1', 'y1', 'x2', 'y2', 'x3', 'y3',
+    'video_ts_ns', 'audio_ts_ns', 'latency_ms', 'realtime_ns',
+    'kind', 'samples', 'timecode_ns', 'stddev_ms', 'ci_ms',
+]
+
+
+def _decode_payload(type_name, payload):
+    # pylint: disable=too-many-return-statements
+    if type_name == 'qrcode':
+        v = struct.unpack_from('<8i', payload)
+        return {'x0': v[0], 'x1': v[1], 'x2': v[2], 'x3': v[3],
+                'y0': v[4], 'y1': v[5], 'y2': v[6], 'y3': v[7]}
+    if type_name == 'video_marker':
+        score, index_max, f, c, q_ms = struct.unpack_from('<fIIII', payload)
+        return {'score': score, 'index_max': index_max, 'f': f, 'c': c, 'q_ms': q_ms}
+    if type_name == 'audio_marker':
+        score, index_max, f = struct.unpack_from('<fII', payload)
+        return {'score': score, 'index_max': index_max, 'f': f}
+    if type_name == 'sync':
+        video_ts, audio_ts, index_max, f = struct.unpack_from('<QQII', payload)
+        return {'video_ts_ns': video_ts, 'audio_ts_ns': audio_ts, 'index_max': index_max, 'f': f,
+                'latency_ms': (audio_ts - video_ts) * 1e-6}
+    if type_name == 'audio_discontinuity':
+        samples, kind, f = struct.unpack_from('<qII', payload)
+        return {'kind': DISCONTINUITY_KINDS.get(kind, str(kind)), 'samples': samples, 'f': f}
+    if type_name == 'glass_latency':
+        timecode_ns, latency_ns = struct.unpack_from('<Qq', payload)
+        return {'timecode_ns': timecode_ns, 'latency_ms': latency_ns * 1e-6}
+    if type_name == 'converged':
+        v = struct.unpack_from('<qqqI', payload)
+        return {'latency_ms': v[0] * 1e-6, 'stddev_ms': v[1] * 1e-6, 'ci_ms': v[2] * 1e-6,
+                'f': v[3]}
+    if type_name == 'start':
+        realtime_ns, = struct.unpack_from('<Q', payload)
+        return {'realtime_ns': realtime_ns}
+    return {}
+
+
+def read_journal(data):
+    '''
+    Returns the list of the records in the order written.
+    Argument:
+    - data -- Content of the journal file
+    '''
+    # pylint: disable=too-many-locals
+    magic, version, header_size, record_size, capacity, _ = \
+        struct.unpack_from(HEADER_FORMAT, data)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('Not a journal file or unsupported version')
+    if len(data) < header_size + record_size * capacity:
+        raise ValueError('Truncated journal file')
+
+    records = []
+    for i in range(capacity):
+        offset = header_size + record_size * i
+        seq, time_ns, type_id, index, timestamp = \
+            struct.unpack_from(RECORD_HEADER_FORMAT, data, offset)
+        # A record never written or being written has `seq` of 0.
+        if seq == 0:
+            continue
+        type_name = TYPE_NAMES.get(type_id, str(type_id))
+        r = {'seq': seq - 1, 'time_ns': time_ns, 'type': type_name, 'index': index,
+             'timestamp_ns': timestamp}
+        payload = data[offset + struct.calcsize(RECORD_HEADER_FORMAT):offset + record_size]
+        r.update(_decode_payload(type_name, payload))
+        records.append(r)
+
+    records.sort(key=lambda r: r['seq'])
+    return records
+
+
+def _main():
+    parser = argparse.ArgumentParser(description='Convert the journal file to CSV')
+    parser.add_argument('-o', '--output', action='store', default=None,
+                        help='Output file name, default is the standard output')
+    parser.add_argument('--type', action='append', default=None, choices=list(TYPE_NAMES.values()),
+                        help='Output only the specified type of the records')
+    parser.add_argument('journal', help='Journal file')
+    args = parser.parse_args()
+
+    with open(args.journal, 'rb') as f:
+        records = read_journal(f.read())
+
+    if args.type:
+        records = [r for r in records if r['type'] in args.type]
+
+    # pylint: disable=consider-using-with
+    out = open(args.output, 'w', newline='', encoding='utf-8') if args.output else sys.stdout
+    writer = csv.DictWriter(out, fieldnames=COLUMNS)
+    writer.writeheader()
+    for r in records:
+        writer.writerow(r)
+    if args.output:
+        out.close()
+
+
+if __name__ == '__main__':
+    _main()
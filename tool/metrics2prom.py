@@ -0,0 +1,212 @@
+#! /usr/bin/env python3
+'''
+Read the metrics file written by the sync-test-output and print it in the
+Prometheus text format.
+'''
+
+import argparse
+import mmap
+import os
+import struct
+import sys
+import time
+
+MAGIC = b'STMETR01'
+VERSION = 2
+MAX_STAGES = 8
+
+HEADER_FORMAT = '<8sIIII32s8x' + f'{16 * MAX_STAGES}s'
+SYNC_FORMAT = '<QQQqQQII'
+VIDEO_FORMAT = '<QQQQQQQQQII' + 'QQQ' * MAX_STAGES
+AUDIO_FORMAT = '<QQQQQQQQQQ'
+
+SYNC_OFFSET = struct.calcsize(HEADER_FORMAT)
+VIDEO_OFFSET = SYNC_OFFSET + struct.calcsize(SYNC_FORMAT)
+AUDIO_OFFSET = VIDEO_OFFSET + struct.calcsize(VIDEO_FORMAT)
+SIZE = AUDIO_OFFSET + struct.calcsize(AUDIO_FORMAT)
+
+WATCHDOG_STATES = ['off', 'learning', 'sleeping', 'sampling', 'alert']
+
+
+def _read_section(m, offset, fmt, retry=1000):
+    '''
+    Returns a consistent copy of the section.
+    The section is being written while `seq` is odd or `seq` has changed.
+    '''
+    size = struct.calcsize(fmt)
+    for _ in range(retry):
+        seq0, = struct.unpack_from('<Q', m, offset)
+        if seq0 & 1:
+            continue
+        data = m[offset:offset + size]
+        seq1, = struct.unpack_from('<Q', m, offset)
+        if seq0 == seq1:
+            return struct.unpack(fmt, data)
+    raise RuntimeError('The section is busy')
+
+
+def read_metrics(m):
+    '''
+    Returns the metrics as a dictionary.
+    Argument:
+    - m -- Content of the metrics file, typically a memory-mapped object
+    '''
+    # pylint: disable=too-many-locals
+    magic, version, size, n_stages, _, name, stage_names = struct.unpack_from(HEADER_FORMAT, m)
+    if magic != MAGIC or version != VERSION or size != SIZE:
+        raise ValueError('Not a metrics file or unsupported version')
+    stage_names = [stage_names[i * 16:(i + 1) * 16].rstrip(b'\0').decode() for i in range(n_stages)]
+
+    s = _read_section(m, SYNC_OFFSET, SYNC_FORMAT)
+    v = _read_section(m, VIDEO_OFFSET, VIDEO_FORMAT)
+    a = _read_section(m, AUDIO_OFFSET, AUDIO_FORMAT)
+
+    stages = {}
+    for i, stage in enumerate(stage_names):
+        count, total_ns, max_ns = v[11 + i * 3:14 + i * 3]
+        stages[stage] = {'count': count, 'total_ns': total_ns, 'max_ns': max_ns}
+
+    return {
+        'name': name.rstrip(b'\0').decode(errors='replace'),
+        'sync': {'seq': s[0], 'updated_ns': s[1], 'count': s[2], 'latency_ns': s[3],
+                 'video_ts': s[4], 'audio_ts': s[5], 'index': s[6], 'index_max': s[7]},
+        'video': {'seq': v[0], 'updated_ns': v[1], 'frames': v[2], 'frames_skipped': v[3],
+                  'frames_repeated': v[4], 'qr_decodes': v[5], 'qr_cache_hits': v[6],
+                  'markers': v[7], 'markers_missed': v[8], 'qr_step': v[9], 'watchdog_state': v[10],
+                  'stages': stages},
+        'audio': {'seq': a[0], 'updated_ns': a[1], 'packets': a[2], 'packets_skipped': a[3],
+                  'markers': a[4], 'markers_missed': a[5], 'discontinuities': a[6],
+                  'samples_dropped': a[7], 'samples_inserted': a[8], 'crc_errors': a[9]},
+    }
+
+
+def _escape(v):
+    return v.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n')
+
+
+def _add_samples(families, metrics):
+    '''
+    Adds the samples of one metrics file to `families`.
+    '''
+    output_label = f'output="{_escape(metrics["name"])}"'
+
+    def add(name, mtype, help_text, samples):
+        family = families.setdefault(name, (mtype, help_text, []))
+        for labels, value in samples:
+            family[2].append((','.join([output_label] + labels), value))
+
+    s, v, a = metrics['sync'], metrics['video'], metrics['audio']
+
+    add('last_update_timestamp_seconds', 'gauge', 'Time when the section was updated',
+        [([f'section="{k}"'], metrics[k]['updated_ns'] * 1e-9) for k in ('sync', 'video', 'audio')])
+    if s['count'] > 0:
+        add('latency_seconds', 'gauge', 'Last latency of the audio to the video',
+            [([], s['latency_ns'] * 1e-9)])
+    add('syncs_total', 'counter', 'Number of the latency measurements', [([], s['count'])])
+
+    add('video_frames_total', 'counter', 'Number of the video frames', [([], v['frames'])])
+    add('video_frames_skipped_total', 'counter', 'Number of the video frames not analyzed',
+        [([], v['frames_skipped'])])
+    add('video_frames_repeated_total', 'counter', 'Number of the repeated video frames',
+        [([], v['frames_repeated'])])
+    add('qr_decodes_total', 'counter', 'Number of the QR code decodes', [([], v['qr_decodes'])])
+    add('qr_cache_hits_total', 'counter', 'Number of the QR code decodes from the cache',
+        [([], v['qr_cache_hits'])])
+    add('qr_step', 'gauge', 'Downscale factor to decode the QR code', [([], v['qr_step'])])
+    state = v['watchdog_state']
+    add('watchdog_state', 'gauge', 'Watchdog state',
+        [([f'state="{n}"'], 1 if i == state else 0) for i, n in enumerate(WATCHDOG_STATES)])
+
+    add('audio_packets_total', 'counter', 'Number of the audio packets', [([], a['packets'])])
+    add('audio_packets_skipped_total', 'counter', 'Number of the audio packets not analyzed',
+        [([], a['packets_skipped'])])
+    add('audio_discontinuities_total', 'counter', 'Number of the jumps of the audio timestamps',
+        [([], a['discontinuities'])])
+    add('audio_samples_slipped_total', 'counter', 'Number of the audio samples dropped or inserted',
+        [(['direction="dropped"'], a['samples_dropped']),
+         (['direction="inserted"'], a['samples_inserted'])])
+    add('audio_crc_errors_total', 'counter', 'Number of the audio markers failed to decode',
+        [([], a['crc_errors'])])
+
+    kinds = (('video', v), ('audio', a))
+    add('markers_total', 'counter', 'Number of the markers found',
+        [([f'kind="{k}"'], x['markers']) for k, x in kinds])
+    add('markers_missed_total', 'counter', 'Number of the markers skipped in the index',
+        [([f'kind="{k}"'], x['markers_missed']) for k, x in kinds])
+    ratios = []
+    for k, x in kinds:
+        n = x['markers'] + x['markers_missed']
+        if n > 0:
+            ratios.append(([f'kind="{k}"'], x['markers_missed'] / n))
+    add('markers_missed_ratio', 'gauge', 'Ratio of the markers missed', ratios)
+
+    stages = v['stages'].items()
+    add('stage_calls_total', 'counter', 'Number of the calls of the analysis stage',
+        [([f'stage="{_escape(n)}"'], x['count']) for n, x in stages])
+    add('stage_seconds_total', 'counter', 'CPU time of the analysis stage',
+        [([f'stage="{_escape(n)}"'], x['total_ns'] * 1e-9) for n, x in stages])
+    add('stage_max_seconds', 'gauge', 'Longest time of the analysis stage',
+        [([f'stage="{_escape(n)}"'], x['max_ns'] * 1e-9) for n, x in stages])
+
+
+def format_prometheus(metrics_list, prefix='obs_avsync'):
+    '''
+    Returns the metrics in the Prometheus text format.
+    Argument:
+    - metrics_list -- List of the metrics returned by `read_metrics`
+    '''
+    families = {}
+    for metrics in metrics_list:
+        _add_samples(families, metrics)
+
+    out = []
+    for name, (mtype, help_text, samples) in families.items():
+        out.append(f'# HELP {prefix}_{name} {help_text}')
+        out.append(f'# TYPE {prefix}_{name} {mtype}')
+        for labels, value in samples:
+            out.append(f'{prefix}_{name}{{{labels}}} {value}')
+    return '\n'.join(out) + '\n'
+
+
+def _write_atomic(filename, text):
+    tmp = f'{filename}.tmp{os.getpid()}'
+    with open(tmp, 'w', encoding='utf-8') as f:
+        f.write(text)
+    os.replace(tmp, filename)
+
+
+def _main():
+    parser = argparse.ArgumentParser(
+            description='Print the metrics file in the Prometheus text format')
+    parser.add_argument('-o', '--output', action='store', default=None,
+                        help='Output file, replaced atomically, default is the standard output')
+    parser.add_argument('--interval', action='store', type=float, default=0,
+                        help='Repeat at the interval in seconds')
+    parser.add_argument('metrics', nargs='+', help='Metrics files')
+    args = parser.parse_args()
+
+    while True:
+        metrics_list = []
+        for filename in args.metrics:
+            try:
+                with open(filename, 'rb') as f, \
+                        mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+                    metrics_list.append(read_metrics(m))
+            except (OSError, ValueError, RuntimeError) as e:
+                # The output might be restarting and initializing the file.
+                print(f'Warning: {filename}: {e}', file=sys.stderr)
+        text = format_prometheus(metrics_list)
+
+        if args.output:
+            _write_atomic(args.output, text)
+        else:
+            sys.stdout.write(text)
+            sys.stdout.flush()
+
+        if args.interval <= 0:
+            break
+        time.sleep(args.interval)
+
+
+if __name__ == '__main__':
+    _main()
@@ -0,0 +1,466 @@
+/*
+OBS Audio Video Sync Dock
+Copyright (C) 2023 Norihiro Kamae <norihiro@nagater.net>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Native version of `videogen.py`.
+ * The frames are streamed to ffmpeg through a pipe, or written to a raw file,
+ * instead of writing a PNG file for each frame. The sync images are rendered
+ * once and the QR code once for each cycle.
+ *
+ * Build:
+ *   c++ -O2 -std=c++17 -Isrc tool/videogen.cpp src/sync-test-pattern.cpp src/sync-test-qrencode.cpp -o videogen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "sync-test-pattern.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define popen _popen
+#define pclose _pclose
+/* The frames are binary, the text mode would translate the line feeds. */
+#define POPEN_WRITE "wb"
+#else
+#define POPEN_WRITE "w"
+#endif
+
+#define QR_PAYLOAD_SIZE 64
+#define AUDIO_CHUNK_SAMPLES 65536
+
+struct context
+{
+	st_pattern base;
+	std::vector<st_pattern> patterns;
+	std::string workdir = ".";
+	std::string output = "output.mp4";
+	std::string raw_video; // write the frames instead of running ffmpeg, "-" for the standard output
+	std::string raw_audio;
+	uint64_t duration = 0;
+	uint64_t max_duration = 600;
+	bool dryrun = false;
+	uint64_t n_repeat = 0;
+	FILE *info = stdout; // standard error while the frames are written to the standard output
+};
+
+static void usage(FILE *fp, const char *argv0)
+{
+	fprintf(fp,
+		"Usage: %s [options] pattern...\n"
+		"Generate audio video synchronization video\n"
+		"\n"
+		"options:\n"
+		"  -w, --workdir DIR     Store temporarily files under this directory\n"
+		"  --vr RATE             Video framerate, default is 30\n"
+		"  --size WxH            Video size, default is 1280x720\n"
+		"  --ar RATE             Audio sampling frequency, default is 48000\n"
+		"  --dryrun              Do not actually generate the video file\n"
+		"  --duration SEC        Duration of the video, 0 for auto-calculation\n"
+		"  --max-duration SEC    Maximum duration, default is 600\n"
+		"  --rectangle           Generate rectangle audio\n"
+		"  --smooth SYM          Symbol length to make the audio smooth, default is 0.25\n"
+		"  --protocol 1|2        Pattern version, 2 has 16-bit index for short patterns\n"
+		"  --binary-qr           Use the compact binary payload for the QR code\n"
+		"  -o, --output FILE     Output file name, default is output.mp4\n"
+		"  --raw-video FILE      Write 8-bit gray frames instead of running ffmpeg, - for the standard output\n"
+		"  --raw-audio FILE      Write signed 16-bit little-endian mono PCM instead of running ffmpeg\n"
+		"\n"
+		"patterns:\n"
+		"  The pattern specifier is a comma (,) separated list of parameters.\n"
+		"  Each parameter consist of keys listed below and '=' and its value.\n"
+		"  - q -- Number of video frames for the QR code and marker patterns\n"
+		"  - f -- Frequency of the audio synchronization marker\n"
+		"  - c -- Number of cycles of the audio synchronization marker\n",
+		argv0);
+}
+
+static bool parse_pattern(st_pattern &p, const char *spec)
+{
+	p.q = 2;
+	p.f = 442;
+	p.c = 0;
+
+	std::string s = spec;
+	size_t pos = 0;
+	while (pos <= s.size()) {
+		size_t end = s.find(',', pos);
+		if (end == std::string::npos)
+			end = s.size();
+		std::string kv = s.substr(pos, end - pos);
+		pos = end + 1;
+
+		size_t eq = kv.find('=');
+		if (eq == std::string::npos) {
+			fprintf(stderr, "Error: Invalid parameter '%s' in %s\n", kv.c_str(), spec);
+			return false;
+		}
+		std::string k = kv.substr(0, eq);
+		uint32_t v = (uint32_t)strtoul(kv.c_str() + eq + 1, NULL, 10);
+		if (k == "q")
+			p.q = v;
+		else if (k == "f")
+			p.f = v;
+		else if (k == "c")
+			p.c = v;
+		else {
+			fprintf(stderr, "Error: Invalid keyword %s in %s\n", k.c_str(), spec);
+			return false;
+		}
+	}
+
+	const char *err = p.setup();
+	if (err) {
+		fprintf(stderr, "Error: %s: %s\n", spec, err);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_args(struct context &ctx, int argc, char **argv)
+{
+	std::vector<const char *> specs;
+
+	for (int i = 1; i < argc; i++) {
+		const char *a = argv[i];
+		auto next = [&]() -> const char * {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Error: %s requires an argument\n", a);
+				exit(1);
+			}
+			return argv[++i];
+		};
+
+		if (strcmp(a, "-h") == 0 || strcmp(a, "--help") == 0) {
+			usage(stdout, argv[0]);
+			exit(0);
+		}
+		else if (strcmp(a, "-w") == 0 || strcmp(a, "--workdir") == 0) {
+			ctx.workdir = next();
+		}
+		else if (strcmp(a, "--vr") == 0) {
+			const char *v = next();
+			ctx.base.fps_num = (uint32_t)strtoul(v, NULL, 10);
+			const char *slash = strchr(v, '/');
+			ctx.base.fps_den = slash ? (uint32_t)strtoul(slash + 1, NULL, 10) : 1;
+		}
+		else if (strcmp(a, "--size") == 0) {
+			if (sscanf(next(), "%ux%u", &ctx.base.width, &ctx.base.height) != 2) {
+				fprintf(stderr, "Error: Invalid size\n");
+				return false;
+			}
+		}
+		else if (strcmp(a, "--ar") == 0) {
+			ctx.base.sample_rate = (uint32_t)strtoul(next(), NULL, 10);
+		}
+		else if (strcmp(a, "--dryrun") == 0) {
+			ctx.dryrun = true;
+		}
+		else if (strcmp(a, "--duration") == 0) {
+			ctx.duration = strtoull(next(), NULL, 10);
+		}
+		else if (strcmp(a, "--max-duration") == 0) {
+			ctx.max_duration = strtoull(next(), NULL, 10);
+		}
+		else if (strcmp(a, "--rectangle") == 0) {
+			ctx.base.rectangle = true;
+		}
+		else if (strcmp(a, "--smooth") == 0) {
+			ctx.base.smooth = (float)atof(next());
+		}
+		else if (strcmp(a, "--protocol") == 0) {
+			int v = atoi(next());
+			if (v != 1 && v != 2) {
+				fprintf(stderr, "Error: Unsupported protocol version %d\n", v);
+				return false;
+			}
+			ctx.base.type_flags = v == 2 ? ST_PATTERN_TYPE_V2 : 0;
+		}
+		else if (strcmp(a, "--binary-qr") == 0) {
+			ctx.base.binary_qr = true;
+		}
+		else if (strcmp(a, "-o") == 0 || strcmp(a, "--output") == 0) {
+			ctx.output = next();
+		}
+		else if (strcmp(a, "--raw-video") == 0) {
+			ctx.raw_video = next();
+		}
+		else if (strcmp(a, "--raw-audio") == 0) {
+			ctx.raw_audio = next();
+		}
+		else if (a[0] == '-' && a[1]) {
+			fprintf(stderr, "Error: Unknown option %s\n", a);
+			return false;
+		}
+		else {
+			specs.push_back(a);
+		}
+	}
+
+	if (ctx.raw_video == "-")
+		ctx.info = stderr;
+
+	if (specs.empty()) {
+		usage(stderr, argv[0]);
+		return false;
+	}
+
+	for (const char *spec : specs) {
+		st_pattern p = ctx.base;
+		if (!parse_pattern(p, spec))
+			return false;
+		ctx.patterns.push_back(p);
+	}
+	return true;
+}
+
+/* Same as `VideoGen.output` in `videogen.py` */
+static void calculate_repeat(struct context &ctx)
+{
+	const st_pattern &b = ctx.base;
+	uint64_t frames = 0;
+	for (const auto &p : ctx.patterns)
+		frames += p.cycle_frames();
+
+	/* Duration of one loop of the patterns in seconds is unit_num / unit_den. */
+	uint64_t unit_num = frames * b.fps_den, unit_den = b.fps_num;
+	uint64_t g = std::gcd(unit_num, unit_den);
+	unit_num /= g;
+	unit_den /= g;
+
+	double duration = (double)ctx.duration;
+	if (!ctx.duration) {
+		uint64_t ar_num = (uint64_t)b.sample_rate * unit_den;
+		duration = (double)(unit_num * ar_num / std::gcd(unit_num, ar_num));
+		if (duration > (double)ctx.max_duration)
+			duration = (double)unit_num * 256 / (double)unit_den;
+		while (duration * (double)unit_den < (double)(unit_num * 256) &&
+		       duration * 2 < (double)ctx.max_duration) {
+			fprintf(ctx.info, "Info: multiplying duration=%g\n", duration);
+			duration *= 2;
+		}
+		fprintf(ctx.info, "Info: duration=%g\n", duration);
+	}
+
+	ctx.n_repeat = (uint64_t)ceil(duration * (double)unit_den / (double)unit_num);
+	if (ctx.n_repeat * unit_num > ctx.max_duration * unit_den)
+		ctx.n_repeat = ctx.max_duration * unit_den / unit_num;
+
+	fprintf(ctx.info, "Info: generating %g seconds video with %" PRIu64 " loops\n",
+		(double)(ctx.n_repeat * unit_num) / (double)unit_den, ctx.n_repeat);
+}
+
+static bool write_audio(const struct context &ctx, const std::string &name)
+{
+	FILE *fp = fopen(name.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Error: Cannot open %s\n", name.c_str());
+		return false;
+	}
+
+	/* Same as `VideoGen._generate_audio`, the burst of each cycle is placed from the first sample of the cycle
+	 * rounded down and the audio is padded until the end of the video rounded up. */
+	const st_pattern &b = ctx.base;
+	std::vector<uint64_t> frame0;
+	uint64_t frames = 0, n = 0;
+	for (const auto &p : ctx.patterns) {
+		frame0.push_back(frames);
+		frames += ctx.n_repeat * p.cycle_frames();
+		if (ctx.n_repeat)
+			n = std::max(n, p.frame_sample(frames - p.cycle_frames()) + p.frame_sample(p.q * 2) +
+						p.burst_samples());
+	}
+	const uint64_t fps_num = b.fps_num;
+	n = std::max(n, (frames * b.fps_den * b.sample_rate + fps_num - 1) / fps_num);
+
+	std::vector<float> samples(AUDIO_CHUNK_SAMPLES), mixed(AUDIO_CHUNK_SAMPLES);
+	std::vector<uint8_t> buf(AUDIO_CHUNK_SAMPLES * 2);
+	for (uint64_t s = 0; s < n; s += AUDIO_CHUNK_SAMPLES) {
+		const size_t len = (size_t)std::min<uint64_t>(AUDIO_CHUNK_SAMPLES, n - s);
+		std::fill(mixed.begin(), mixed.begin() + len, 0.0f);
+		for (size_t ip = 0; ip < ctx.patterns.size(); ip++) {
+			ctx.patterns[ip].audio_fill(samples.data(), s, len, frame0[ip], ctx.n_repeat);
+			for (size_t i = 0; i < len; i++)
+				mixed[i] += samples[i];
+		}
+		for (size_t i = 0; i < len; i++) {
+			long v = lround(mixed[i] * 32767.0f);
+			v = std::min(std::max(v, -32768L), 32767L);
+			buf[i * 2] = (uint8_t)v;
+			buf[i * 2 + 1] = (uint8_t)((unsigned long)v >> 8);
+		}
+		if (fwrite(buf.data(), 2, len, fp) != len) {
+			fprintf(stderr, "Error: Cannot write %s\n", name.c_str());
+			fclose(fp);
+			return false;
+		}
+	}
+
+	return fclose(fp) == 0;
+}
+
+/* Same as `index_max` set by `VideoGen._generate_video` */
+static uint32_t index_max_of(const struct context &ctx, uint64_t i, uint32_t m)
+{
+	if (ctx.n_repeat <= m)
+		return (uint32_t)ctx.n_repeat;
+	if (i < ctx.n_repeat - ctx.n_repeat % m)
+		return m;
+	return (uint32_t)((ctx.n_repeat - 1) % m + 1);
+}
+
+static bool write_video(const struct context &ctx, FILE *fp)
+{
+	const st_pattern &b = ctx.base;
+	const size_t frame_size = (size_t)b.width * b.height;
+	std::vector<uint8_t> qr_image(frame_size), sync_images[2];
+	for (int ix = 0; ix < 2; ix++) {
+		sync_images[ix].resize(frame_size);
+		b.render_sync(sync_images[ix].data(), b.width, ix);
+	}
+
+	st_qrcode qr;
+	for (const auto &p : ctx.patterns) {
+		const uint32_t m = p.index_modulus();
+		for (uint64_t i = 0; i < ctx.n_repeat; i++) {
+			uint8_t payload[QR_PAYLOAD_SIZE];
+			size_t len = p.payload(payload, sizeof(payload), (uint32_t)(i % m), index_max_of(ctx, i, m), 0);
+			if (!len || !qr.encode(payload, len)) {
+				fprintf(stderr, "Error: Cannot encode the QR code\n");
+				return false;
+			}
+			p.render_qrcode(qr_image.data(), p.width, qr);
+
+			const uint8_t *images[3] = {qr_image.data(), sync_images[0].data(), sync_images[1].data()};
+			for (const uint8_t *img : images) {
+				for (uint32_t k = 0; k < p.q; k++) {
+					if (fwrite(img, 1, frame_size, fp) != frame_size) {
+						fprintf(stderr, "Error: Cannot write the video\n");
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/* Quotes an argument for the shell that runs ffmpeg. */
+static std::string quote(const std::string &s)
+{
+#ifdef _WIN32
+	/* `cmd.exe` does not accept the single quotes. A file name cannot contain the double quote. */
+	return "\"" + s + "\"";
+#else
+	std::string r = "'";
+	for (char c : s) {
+		if (c == '\'')
+			r += "'\\''";
+		else
+			r += c;
+	}
+	return r + "'";
+#endif
+}
+
+static bool run_ffmpeg(const struct context &ctx, const std::string &audio_name)
+{
+	const st_pattern &b = ctx.base;
+	char buf[256];
+	std::string cmd = "ffmpeg -hide_banner -loglevel warning";
+
+	snprintf(buf, sizeof(buf), " -f rawvideo -pix_fmt gray -video_size %ux%u", b.width, b.height);
+	cmd += buf;
+	if (b.fps_den == 1)
+		snprintf(buf, sizeof(buf), " -framerate %u -i -", b.fps_num);
+	else
+		snprintf(buf, sizeof(buf), " -framerate %u/%u -i -", b.fps_num, b.fps_den);
+	cmd += buf;
+	snprintf(buf, sizeof(buf), " -channel_layout mono -f s16le -ac 1 -ar %u -i ", b.sample_rate);
+	cmd += buf + quote(audio_name);
+	cmd += " -pix_fmt yuv420p -b:a 192k";
+	if (ctx.output.size() >= 4 && ctx.output.compare(ctx.output.size() - 4, 4, ".mp4") == 0)
+		cmd += " -movflags +faststart";
+	cmd += " -y " + quote(ctx.output);
+
+	FILE *fp = popen(cmd.c_str(), POPEN_WRITE);
+	if (!fp) {
+		fprintf(stderr, "Error: Cannot run ffmpeg\n");
+		return false;
+	}
+	bool ok = write_video(ctx, fp);
+	int ret = pclose(fp);
+	if (ret != 0) {
+		fprintf(stderr, "Error: ffmpeg exited with %d\n", ret);
+		return false;
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	struct context ctx;
+	if (!parse_args(ctx, argc, argv))
+		return 1;
+
+	calculate_repeat(ctx);
+	if (ctx.dryrun)
+		return 0;
+
+#ifndef _WIN32
+	/* If ffmpeg exits early, fail the write instead of being killed so that the audio file is removed. */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	if (!ctx.raw_video.empty() || !ctx.raw_audio.empty()) {
+		if (!ctx.raw_audio.empty() && !write_audio(ctx, ctx.raw_audio))
+			return 1;
+		if (ctx.raw_video.empty())
+			return 0;
+#ifdef _WIN32
+		if (ctx.raw_video == "-")
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		FILE *fp = ctx.raw_video == "-" ? stdout : fopen(ctx.raw_video.c_str(), "wb");
+		if (!fp) {
+			fprintf(stderr, "Error: Cannot open %s\n", ctx.raw_video.c_str());
+			return 1;
+		}
+		bool ok = write_video(ctx, fp);
+		if (fp != stdout)
+			ok = fclose(fp) == 0 && ok;
+		return ok ? 0 : 1;
+	}
+
+	/* The audio is small and written first so that the frames can be streamed through the standard input. */
+	std::string base = ctx.output.substr(ctx.output.find_last_of("/\\") + 1);
+	std::string audio_name = ctx.workdir + "/" + base + ".pcm";
+	if (!write_audio(ctx, audio_name))
+		return 1;
+	bool ok = run_ffmpeg(ctx, audio_name);
+	remove(audio_name.c_str());
+	return ok ? 0 : 1;
+}
@@ -7,6 +7,7 @@ import argparse
 import math
 import os
 import shutil
+import struct
 import subprocess
 from PIL import Image, ImageDraw, ImageFont
 import qrcode
@@ -33,6 +34,31 @@ def crc4(data, size):
     return data
 
 
+def crc8(data, size):
+    '''
+    Calculates CRC-8 with the polynomial x^8 + x^2 + x + 1
+    Argument:
+    - data -- int type data to calculate the CRC
+    - size -- number of bits
+    '''
+    data <<= 8
+    p = 0x107 << (size - 1)
+    while size > 0:
+        if data & (0x80 << size):
+            data ^= p
+        size -= 1
+        p >>= 1
+    return data
+
+
+# Bit of `t=` in the QR code
+# The index has 16 bits and the audio has CRC-8 instead of CRC-4.
+TYPE_FLAG_V2 = 0x1
+
+# First byte of the binary payload of the QR code
+QR_BINARY_V1 = 0x81
+
+
 class Context:
     '''
     Holds context information
@@ -42,6 +68,8 @@ class Context:
     - ar -- Audio sampling frequency
     - width -- Video width
     - height -- Video height
+    - type_flags -- Flags sent as `t=` in the QR code
+    - binary_qr -- Use the binary payload for the QR code
     '''
     # pylint: disable=too-many-instance-attributes
     def __init__(self, workdir, vr, ar):
@@ -66,6 +94,7 @@ class Context:
         self._img_index = 0
         self._sync_image_cache = {}
         self.type_flags = 0
+        self.binary_qr = False
         self._image_files = []
 
     def set_video_size(self, size):
@@ -108,6 +137,25 @@ class Context:
         self._sync_image_cache[ix] = name
         return name
 
+    def set_protocol(self, version):
+        '''
+        Set the version of the pattern
+        Argument:
+        - version -- 1 for 8-bit index, 2 for 16-bit index
+        '''
+        if version == 2:
+            self.type_flags |= TYPE_FLAG_V2
+        elif version == 1:
+            self.type_flags &= ~TYPE_FLAG_V2
+        else:
+            raise ValueError(f'Unsupported protocol version {version}')
+
+    def index_modulus(self):
+        '''
+        Returns the number of the distinct indices
+        '''
+        return 0x10000 if self.type_flags & TYPE_FLAG_V2 else 0x100
+
     def remove_image_files(self):
         '''
         Remove all image files returned by `next_image()`
@@ -124,7 +172,8 @@ class Context:
         '''
         Returns the number of audio symbols
         '''
-        n_bits = 20
+        # 8-bit preamble, index, and CRC
+        n_bits = 32 if ctx.type_flags & TYPE_FLAG_V2 else 20
         return ctx._audio_bits_to_symbols(n_bits)
 
     def audio_symbols_before_vsync(ctx):
@@ -194,8 +243,14 @@ class Pattern:
         ctx = self.ctx
         f, c = self.f, self.c
         q_ms = self.q * 1000 * ctx.vr[1] // ctx.vr[0]
-        qr_img = qrcode.make(f'q={q_ms},i={i},f={f},c={c},t={ctx.type_flags},I={self.index_max}',
-                             error_correction=qrcode.constants.ERROR_CORRECT_M).get_image()
+        if ctx.binary_qr:
+            # See ST_QR_BINARY_V1 in src/sync-test-output.hpp
+            payload = struct.pack('<BHHHBHH', QR_BINARY_V1, q_ms, f, c, ctx.type_flags, i,
+                                  self.index_max - 1)
+            payload = qrcode.util.QRData(payload, mode=qrcode.util.MODE_8BIT_BYTE)
+        else:
+            payload = f'q={q_ms},i={i},f={f},c={c},t={ctx.type_flags},I={self.index_max}'
+        qr_img = qrcode.make(payload, error_correction=qrcode.constants.ERROR_CORRECT_M).get_image()
         size = min(ctx.width, ctx.height)
         qr_img = qr_img.resize((size, size))
         base_img = Image.new('RGB', (ctx.width, ctx.height), (127, 127, 127))
@@ -211,7 +266,7 @@ class Pattern:
         '''
         Returns a list of video frame files
         '''
-        qr_filename = self._gen_qrcode(self.i & 0xFF)
+        qr_filename = self._gen_qrcode(self.i % self.ctx.index_modulus())
         r_qr = [qr_filename] * self.q
         r_s0 = [self.ctx.sync_image(0)] * self.q
         r_s1 = [self.ctx.sync_image(1)] * self.q
@@ -233,10 +288,16 @@ class Pattern:
         f, c = self.f, self.c
         ctx = self.ctx
 
-        data = 0xf000 | (self.i & 0xFF)
-        n_bit = 16
-        data = data << 4 | crc4(data, n_bit)
-        n_bit += 4
+        if ctx.type_flags & TYPE_FLAG_V2:
+            data = 0xf00000 | (self.i & 0xFFFF)
+            n_bit = 24
+            data = data << 8 | crc8(data, n_bit)
+            n_bit += 8
+        else:
+            data = 0xf000 | (self.i & 0xFF)
+            n_bit = 16
+            data = data << 4 | crc4(data, n_bit)
+            n_bit += 4
 
         n_center = ctx.ar * (self.q * 2) * ctx.vr[1] // ctx.vr[0]
         n_pattern = ctx.audio_symbols() * c * ctx.ar // f
@@ -307,17 +368,18 @@ class VideoGen:
 
     def _generate_video(self, i0_fmt, n_repeat):
         i_frame = 0
+        m = self.ctx.index_modulus()
         for p in self.patterns:
             i = 0
             p.i = 0
-            if n_repeat <= 256:
+            if n_repeat <= m:
                 p.index_max = n_repeat
             while i < n_repeat:
-                if n_repeat > 256:
-                    if i < (n_repeat & ~0xFF):
-                        p.index_max = 256
+                if n_repeat > m:
+                    if i < n_repeat - n_repeat % m:
+                        p.index_max = m
                     else:
-                        p.index_max = ((n_repeat - 1) & 0xFF) + 1
+                        p.index_max = (n_repeat - 1) % m + 1
                 for f in p.video_frames():
                     os.link(f, i0_fmt % i_frame)
                     i_frame += 1
@@ -427,6 +489,10 @@ def _main():
                         help='Generate rectangle audio')
     parser.add_argument('--smooth', action='store', type=float, default=0.25,
                         help='Symbol length to make the audio smooth')
+    parser.add_argument('--protocol', action='store', type=int, default=1, choices=[1, 2],
+                        help='Pattern version, 2 has 16-bit index for short patterns')
+    parser.add_argument('--binary-qr', action='store_true', default=False,
+                        help='Use the compact binary payload for the QR code')
     parser.add_argument('-o', '--output', action='store', default='output.mp4',
                         help='Output file name')
     parser.add_argument('patterns', nargs='+', help='Pattern definition of synchronization marker')
@@ -436,6 +502,8 @@ def _main():
         ctx.set_video_size(args.size)
     ctx.audio_rectangle = args.rectangle
     ctx.audio_continuous = args.smooth
+    ctx.set_protocol(args.protocol)
+    ctx.binary_qr = args.binary_qr
     gen = VideoGen(ctx)
     for p in args.patterns:
         p = Pattern(ctx, p)